@@ -1,14 +1,23 @@
 #pragma once
 
 #include <cmath>
-#include <memory>
+#include <cstdint>
+#include <iterator>
+#include <span>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "Allocation.hpp"
 #include "SymbolTable.hpp"
 #include "lexer.hpp"
 #include "logger.hpp"
+#include "output.hpp"
+
+class ASTArena;
+
+// Index of a node inside its ASTArena.
+using NodeId = std::uint32_t;
 
 class ASTNode {
 public:
@@ -20,96 +29,294 @@ public:
     VARIABLE,
     VALUE,
     PRINT,
+    // Fused statements built by Superinstructions.hpp; they have no children.
+    ASSIGN_CONST, // slot `id` = `value`
+    ASSIGN_SLOT,  // slot `id` = slot `operand`
+    TYPE_COUNT,
   };
 
+  static constexpr const char *TypeName(Type type) {
+    constexpr const char *names[] = {"EMPTY", "STATEMENT_BLOCK", "EXPRESSION", "ASSIGN", "VARIABLE",
+                                     "VALUE", "PRINT", "ASSIGN_CONST", "ASSIGN_SLOT"};
+    static_assert(std::size(names) == TYPE_COUNT);
+    return type < TYPE_COUNT ? names[type] : "?";
+  }
+
 private:
+  friend class ASTArena;
+
   Type type = EMPTY;
-  std::size_t id;
-  double value;
-  std::vector<std::shared_ptr<ASTNode>> child{};
-  emplex::Token token;
-
-  void RunAssign(SymbolTable &symbols) {
-    logger << "Running assign" << std::endl;
-    // Run expression
-    child.at(1)->Run(symbols);
-    // Set the value
-    symbols.SetValue(0, child.at(0)->GetId(), child.at(1)->GetValue());
-  }
-
-  void RunPrint(SymbolTable &symbols) {
-    logger << "Running print with children: " << child.size() << std::endl;
-    for (auto children : child) {
-      children->Run(symbols);
-      children->PrintNode(std::cout);
-    }
-    std::cout << std::endl;
-  }
+  std::uint32_t operand = 0; // Source slot of ASSIGN_SLOT (fits in Type's padding)
+  std::size_t id = 0;
+  double value = 0.0;
+  std::size_t line = 0;
+  // Children live in ASTArena::children[first_child, first_child + child_count)
+  std::uint32_t first_child = 0;
+  std::uint32_t child_count = 0;
 
-  void RunExpression(SymbolTable &symbols) {
-    logger << "Running expression" << std::endl;
-    child.at(0)->Run(symbols);
-    SetValue(child.at(0)->GetValue());
-  }
+  void RunAssign(ASTArena &arena, SymbolTable &symbols);
+  void RunPrint(ASTArena &arena, SymbolTable &symbols);
+  void RunExpression(ASTArena &arena, SymbolTable &symbols);
 
   void RunVariable(SymbolTable &symbols) {
-    logger << "Running variable" << std::endl;
-    SetValue(symbols.GetValue(0, GetId()));
+    LOG(TRACE) << "Running variable";
+    SetValue(symbols.GetValue(GetId()));
   }
 
-  void PrintNode(std::ostream &stream) {
-    stream << GetValue();
+  void PrintNode(OutputBuffer &out) {
+    out.Write(GetValue());
   };
 
 public:
   ASTNode() {};
   ASTNode(Type type)
       : type{type} {};
-  ASTNode(Type type, emplex::Token token)
-      : type{type}, token(token) {};
+  ASTNode(Type type, std::size_t line)
+      : type{type}, line(line) {};
+
+  double Run(ASTArena &arena, SymbolTable &symbols);
+
+  std::size_t GetId() const { return id; };
+  std::uint32_t GetOperand() const { return operand; }
+  double GetValue() const { return value; }
+  std::size_t GetLine() const { return line; }
+  ASTNode::Type GetType() const {
+    return type;
+  }
+  void SetId(size_t newId) { id = newId; };
+  void SetValue(double newValue) { value = newValue; };
+};
+
+// Owns every node of a program. Nodes are stored by value in one vector and
+// refer to their children through contiguous ranges of a shared index vector,
+// so building and walking the tree needs no per-node allocation.
+class ASTArena {
+private:
+  std::vector<ASTNode, TaggedAllocator<ASTNode, Structure::AST>> nodes{};
+  std::vector<NodeId, TaggedAllocator<NodeId, Structure::AST>> children{};
+
+public:
+  NodeId Add(ASTNode::Type type = ASTNode::EMPTY, std::size_t line = 0) {
+    nodes.emplace_back(type, line);
+    return static_cast<NodeId>(nodes.size() - 1);
+  }
+
+  /// Attach a finished child list. Setting it again leaves the old range unreferenced.
+  void SetChildren(NodeId parent, std::span<const NodeId> ids) {
+    ASTNode &node = nodes[parent];
+    node.first_child = static_cast<std::uint32_t>(children.size());
+    node.child_count = static_cast<std::uint32_t>(ids.size());
+    children.insert(children.end(), ids.begin(), ids.end());
+  }
+
+  std::span<const NodeId> GetChildren(const ASTNode &node) const {
+    return {children.data() + node.first_child, node.child_count};
+  }
+  std::span<const NodeId> GetChildren(NodeId parent) const {
+    return GetChildren(nodes[parent]);
+  }
+
+  NodeId GetChild(const ASTNode &node, std::size_t index) const {
+    return children[node.first_child + index];
+  }
+
+  /// Turn a node into a literal; its old children are simply no longer referenced.
+  void ReplaceWithValue(NodeId id, double value) {
+    ASTNode &node = nodes[id];
+    node.type = ASTNode::VALUE;
+    node.value = value;
+    node.child_count = 0;
+  }
+
+  /// Turn a node into a read of `slot`.
+  void ReplaceWithVariable(NodeId id, std::size_t slot) {
+    ASTNode &node = nodes[id];
+    node.type = ASTNode::VARIABLE;
+    node.id = slot;
+    node.child_count = 0;
+  }
+
+  /// Turn an assignment into ASSIGN_CONST (slot = value).
+  void ReplaceWithAssignConst(NodeId id, std::size_t slot, double value) {
+    ASTNode &node = nodes[id];
+    node.type = ASTNode::ASSIGN_CONST;
+    node.id = slot;
+    node.value = value;
+    node.child_count = 0;
+  }
 
-  void AddChild(std::shared_ptr<ASTNode> node) {
-    child.push_back(node);
+  /// Turn an assignment into ASSIGN_SLOT (slot = source).
+  void ReplaceWithAssignSlot(NodeId id, std::size_t slot, std::uint32_t source) {
+    ASTNode &node = nodes[id];
+    node.type = ASTNode::ASSIGN_SLOT;
+    node.id = slot;
+    node.operand = source;
+    node.child_count = 0;
   }
 
-  double Run(SymbolTable &symbols) {
-    if (GetType() == Type::EMPTY || GetType() == Type::STATEMENT_BLOCK) {
-      logger << "Running type: " << GetType() << std::endl;
-      for (auto children : child) {
-        if (children != nullptr) {
-          children->Run(symbols);
+  /// Move a statement `delta` lines, along with its expression nodes (not nested statements).
+  /// Nodes without a source line (0) keep it.
+  void ShiftLines(NodeId id, std::ptrdiff_t delta) {
+    ASTNode &node = nodes[id];
+    if (node.line != 0) {
+      node.line = static_cast<std::size_t>(static_cast<std::ptrdiff_t>(node.line) + delta);
+    }
+    if (node.type != ASTNode::STATEMENT_BLOCK) {
+      for (NodeId child : GetChildren(node)) {
+        ShiftLines(child, delta);
+      }
+    }
+  }
+
+  /**
+   * Check that nodes and child ranges read back from disk (see ScriptCache) form a program the
+   * engines can run without bounds checks: every type is known, every child range and child id
+   * is in range, every slot is inside a frame of `frame_size`, assignments and expressions have
+   * the children they are read through, and the nodes reachable from `root` form a tree.
+   */
+  static bool IsRunnable(std::span<const ASTNode> saved_nodes, std::span<const NodeId> saved_children, NodeId root,
+                         std::size_t frame_size) {
+    if (root >= saved_nodes.size() || saved_nodes[root].type != ASTNode::STATEMENT_BLOCK) {
+      return false;
+    }
+    for (const ASTNode &node : saved_nodes) {
+      if (static_cast<std::uint32_t>(node.type) >= ASTNode::TYPE_COUNT ||
+          std::uint64_t{node.first_child} + node.child_count > saved_children.size()) {
+        return false;
+      }
+      for (std::size_t i = 0; i < node.child_count; ++i) {
+        if (saved_children[node.first_child + i] >= saved_nodes.size()) {
+          return false;
+        }
+      }
+      switch (node.type) {
+        case ASTNode::VARIABLE:
+        case ASTNode::ASSIGN_CONST:
+          if (node.id >= frame_size) {
+            return false;
+          }
+          break;
+        case ASTNode::ASSIGN_SLOT:
+          if (node.id >= frame_size || node.operand >= frame_size) {
+            return false;
+          }
+          break;
+        case ASTNode::ASSIGN:
+          if (node.child_count != 2 ||
+              saved_nodes[saved_children[node.first_child]].type != ASTNode::VARIABLE) {
+            return false;
+          }
+          break;
+        case ASTNode::EXPRESSION:
+          if (node.child_count != 1) {
+            return false;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    // Nothing reachable may be reached twice, which also rules out cycles.
+    std::vector<bool> seen(saved_nodes.size(), false);
+    std::vector<NodeId> stack = {root};
+    seen[root] = true;
+    while (!stack.empty()) {
+      const ASTNode &node = saved_nodes[stack.back()];
+      stack.pop_back();
+      for (std::size_t i = 0; i < node.child_count; ++i) {
+        const NodeId child = saved_children[node.first_child + i];
+        if (seen[child]) {
+          return false;
         }
+        seen[child] = true;
+        stack.push_back(child);
       }
-      return 1;
     }
+    return true;
+  }
+
+  /// Replace the whole tree with nodes and child ranges saved from another arena.
+  void Assign(std::span<const ASTNode> saved_nodes, std::span<const NodeId> saved_children) {
+    nodes.assign(saved_nodes.begin(), saved_nodes.end());
+    children.assign(saved_children.begin(), saved_children.end());
+  }
+  std::span<const ASTNode> GetNodes() const { return nodes; }
+  std::span<const NodeId> GetChildIds() const { return children; }
 
-    logger << "Running line: " << token.line_id << std::endl;
-
-    switch (type) {
-      case Type::PRINT:
-        RunPrint(symbols);
-        break;
-      case Type::ASSIGN:
-        RunAssign(symbols);
-        break;
-      case Type::EXPRESSION:
-        RunExpression(symbols);
-        break;
-      case Type::VARIABLE:
-        RunVariable(symbols);
-        break;
-      default:
-        break;
+  ASTNode &operator[](NodeId id) { return nodes[id]; }
+  const ASTNode &operator[](NodeId id) const { return nodes[id]; }
+
+  std::size_t size() const { return nodes.size(); }
+};
+
+inline void ASTNode::RunAssign(ASTArena &arena, SymbolTable &symbols) {
+  LOG(TRACE) << "Running assign";
+  auto ids = arena.GetChildren(*this);
+  ASTNode &expression = arena[ids[1]];
+  // Run expression
+  expression.Run(arena, symbols);
+  // Set the value
+  symbols.SetValue(arena[ids[0]].GetId(), expression.GetValue());
+}
+
+inline void ASTNode::RunPrint(ASTArena &arena, SymbolTable &symbols) {
+  LOG(TRACE) << "Running print with children: " << child_count;
+  OutputBuffer &out = output;
+  for (NodeId id : arena.GetChildren(*this)) {
+    ASTNode &item = arena[id];
+    // Literals and plain variables (see Superinstructions.hpp) are printed without visiting them.
+    if (item.GetType() == Type::VALUE) {
+      out.Write(item.GetValue());
+    } else if (item.GetType() == Type::VARIABLE) {
+      out.Write(symbols.GetValue(item.GetId()));
+    } else {
+      item.Run(arena, symbols);
+      item.PrintNode(out);
     }
+  }
+  out.EndLine();
+}
+
+inline void ASTNode::RunExpression(ASTArena &arena, SymbolTable &symbols) {
+  LOG(TRACE) << "Running expression";
+  ASTNode &term = arena[arena.GetChild(*this, 0)];
+  term.Run(arena, symbols);
+  SetValue(term.GetValue());
+}
 
+inline double ASTNode::Run(ASTArena &arena, SymbolTable &symbols) {
+  if (GetType() == Type::EMPTY || GetType() == Type::STATEMENT_BLOCK) {
+    LOG(TRACE) << "Running type: " << GetType();
+    for (NodeId id : arena.GetChildren(*this)) {
+      arena[id].Run(arena, symbols);
+    }
     return 1;
   }
 
-  std::size_t GetId() const { return id; };
-  double GetValue() const { return value; }
-  ASTNode::Type GetType() const {
-    return type;
+  LOG(TRACE) << "Running line: " << line;
+
+  switch (type) {
+    case Type::PRINT:
+      RunPrint(arena, symbols);
+      break;
+    case Type::ASSIGN:
+      RunAssign(arena, symbols);
+      break;
+    case Type::ASSIGN_CONST:
+      symbols.SetValue(GetId(), GetValue());
+      break;
+    case Type::ASSIGN_SLOT:
+      symbols.SetValue(GetId(), symbols.GetValue(operand));
+      break;
+    case Type::EXPRESSION:
+      RunExpression(arena, symbols);
+      break;
+    case Type::VARIABLE:
+      RunVariable(symbols);
+      break;
+    default:
+      break;
   }
-  void SetId(size_t newId) { id = newId; };
-  void SetValue(double newValue) { value = newValue; };
-};
+
+  return 1;
+}
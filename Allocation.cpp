@@ -0,0 +1,25 @@
+// Replacement global allocation functions for builds with MC_TRACK_ALLOCATIONS=1
+// (see Allocation.hpp). Other builds compile this file to nothing.
+#include "Allocation.hpp"
+
+#if MC_TRACK_ALLOCATIONS
+// Kept out of line so GCC does not pair the inlined malloc/free against new/delete.
+[[gnu::noinline]] void *operator new(std::size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    if (AllocationTracker::Enabled()) {
+      AllocationTracker::OnAllocate(ptr, size);
+    }
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *ptr) noexcept {
+  if (ptr != nullptr && AllocationTracker::Enabled()) {
+    AllocationTracker::OnFree(ptr);
+  }
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete(void *ptr, std::size_t) noexcept { operator delete(ptr); }
+#endif
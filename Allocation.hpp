@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// == Allocation hooks ==
+// Builds with MC_TRACK_ALLOCATIONS=1 (make bench, make tracked) replace the
+// global allocation functions so --bench can report how many allocations each
+// phase makes and --mem-report where the bytes go (see MemoryReport.hpp).
+// There every allocation costs two relaxed atomic adds and a relaxed load, and
+// every free a relaxed load, even outside of those modes; other builds keep
+// the standard allocator and pay nothing. Replacement allocation functions
+// cannot be inline, so they are defined once, in Allocation.cpp.
+#ifndef MC_TRACK_ALLOCATIONS
+#define MC_TRACK_ALLOCATIONS 0
+#endif
+
+inline std::atomic<std::size_t> alloc_count{0};
+inline std::atomic<std::size_t> alloc_bytes{0};
+
+// What a heap block belongs to, for --mem-report. Code that allocates for one
+// of these says so with a MemoryTag (or a TaggedAllocator); the rest is OTHER.
+enum class Structure : std::uint8_t { OTHER, TOKENS, INTERNER, AST, SYMBOLS, BYTECODE, COUNT };
+
+// Pipeline stage allocations are charged to, for --mem-report.
+enum class MemoryPhase : std::uint8_t { LEX, PARSE, OPTIMIZE, LOWER, EXECUTE, COUNT };
+
+// Heap use of a phase, a structure or the whole run, while tracked.
+struct MemoryCounters {
+  std::uint64_t allocs = 0;
+  std::uint64_t bytes = 0; // Allocated in total
+  std::uint64_t live = 0;  // Phases: total live bytes when the phase ended
+  std::uint64_t peak = 0;  // Phases: highest total live bytes during the phase
+};
+
+struct MemoryCounts {
+  MemoryCounters total;
+  MemoryCounters phases[static_cast<std::size_t>(MemoryPhase::COUNT)];
+  MemoryCounters structures[static_cast<std::size_t>(Structure::COUNT)];
+};
+
+// Live and peak heap bytes by phase and by structure, kept while enabled.
+// Every tracked block is recorded in an open-addressing table (allocated with
+// malloc, so it does not track itself) along with what it was charged to, so a
+// free is credited back to the structure that made the allocation. Blocks
+// allocated before tracking started are ignored when freed.
+class AllocationTracker {
+public:
+  static constexpr const char *PhaseName(MemoryPhase phase) {
+    constexpr const char *names[] = {"lex", "parse", "optimize", "lower", "execute"};
+    return names[static_cast<std::size_t>(phase)];
+  }
+  static constexpr const char *StructureName(Structure structure) {
+    constexpr const char *names[] = {"other", "tokens", "interner", "ast", "symbols", "bytecode"};
+    return names[static_cast<std::size_t>(structure)];
+  }
+
+private:
+  friend class MemoryTag;
+
+  struct Entry {
+    void *block = nullptr;
+    std::size_t size = 0;
+    Structure structure = Structure::OTHER;
+  };
+
+  static constexpr std::size_t INITIAL_CAPACITY = std::size_t{1} << 16;
+
+  static inline std::atomic<bool> enabled{false};
+  static inline thread_local Structure structure = Structure::OTHER;
+  static inline std::atomic<MemoryPhase> phase{MemoryPhase::LEX};
+  static inline std::atomic_flag lock = ATOMIC_FLAG_INIT;
+  static inline MemoryCounts counts{};
+  static inline Entry *table = nullptr; // Capacity is a power of two, at most half full
+  static inline std::size_t capacity = 0;
+  static inline std::size_t used = 0;
+
+  struct Lock {
+    Lock() {
+      while (lock.test_and_set(std::memory_order_acquire)) {
+      }
+    }
+    ~Lock() { lock.clear(std::memory_order_release); }
+  };
+
+  static std::size_t Home(const void *block) {
+    return static_cast<std::size_t>((reinterpret_cast<std::uintptr_t>(block) >> 4) * 0x9E3779B97F4A7C15ull) &
+           (capacity - 1);
+  }
+
+  static bool Grow() {
+    const std::size_t old_capacity = capacity;
+    Entry *old_table = table;
+    auto *grown = static_cast<Entry *>(std::calloc(old_capacity * 2, sizeof(Entry)));
+    if (grown == nullptr) {
+      return false;
+    }
+    table = grown;
+    capacity = old_capacity * 2;
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+      if (old_table[i].block != nullptr) {
+        std::size_t slot = Home(old_table[i].block);
+        while (table[slot].block != nullptr) {
+          slot = (slot + 1) & (capacity - 1);
+        }
+        table[slot] = old_table[i];
+      }
+    }
+    std::free(old_table);
+    return true;
+  }
+
+  // Remove the entry at `slot`, shifting later entries of the probe run back into the hole.
+  static void Erase(std::size_t slot) {
+    std::size_t next = (slot + 1) & (capacity - 1);
+    while (table[next].block != nullptr) {
+      const std::size_t home = Home(table[next].block);
+      // Move it back unless its home lies cyclically within (slot, next].
+      if (((next - home) & (capacity - 1)) >= ((next - slot) & (capacity - 1))) {
+        table[slot] = table[next];
+        slot = next;
+      }
+      next = (next + 1) & (capacity - 1);
+    }
+    table[slot] = Entry{};
+    --used;
+  }
+
+public:
+  static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+  /// Begin tracking from zero, charging allocations to `first`.
+  static bool Start(MemoryPhase first) {
+    Lock guard;
+    table = static_cast<Entry *>(std::calloc(INITIAL_CAPACITY, sizeof(Entry)));
+    if (table == nullptr) {
+      return false;
+    }
+    capacity = INITIAL_CAPACITY;
+    used = 0;
+    counts = {};
+    phase.store(first, std::memory_order_relaxed);
+    enabled.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Stop tracking and return the counts; blocks still live are forgotten.
+  static MemoryCounts Stop() {
+    enabled.store(false, std::memory_order_relaxed);
+    Lock guard;
+    std::free(table);
+    table = nullptr;
+    capacity = used = 0;
+    return counts;
+  }
+
+  static void SetPhase(MemoryPhase next) {
+    Lock guard;
+    phase.store(next, std::memory_order_relaxed);
+    MemoryCounters &entered = counts.phases[static_cast<std::size_t>(next)];
+    entered.live = counts.total.live;
+    entered.peak = std::max(entered.peak, entered.live);
+  }
+
+  /// Current counts, while tracking continues.
+  static MemoryCounts Read() {
+    Lock guard;
+    return counts;
+  }
+
+  static void OnAllocate(void *block, std::size_t size) {
+    Lock guard;
+    if (table == nullptr || ((used + 1) * 2 > capacity && !Grow())) {
+      return;
+    }
+    std::size_t slot = Home(block);
+    while (table[slot].block != nullptr) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    table[slot] = {block, size, structure};
+    ++used;
+
+    MemoryCounters &owner = counts.structures[static_cast<std::size_t>(structure)];
+    MemoryCounters &stage = counts.phases[static_cast<std::size_t>(phase.load(std::memory_order_relaxed))];
+    for (MemoryCounters *counters : {&counts.total, &owner}) {
+      ++counters->allocs;
+      counters->bytes += size;
+      counters->live += size;
+      counters->peak = std::max(counters->peak, counters->live);
+    }
+    ++stage.allocs;
+    stage.bytes += size;
+    stage.live = counts.total.live;
+    stage.peak = std::max(stage.peak, stage.live);
+  }
+
+  static void OnFree(void *block) {
+    Lock guard;
+    if (table == nullptr) {
+      return;
+    }
+    std::size_t slot = Home(block);
+    while (table[slot].block != block) {
+      if (table[slot].block == nullptr) {
+        return; // Allocated before tracking started
+      }
+      slot = (slot + 1) & (capacity - 1);
+    }
+    const Entry entry = table[slot];
+    Erase(slot);
+    counts.total.live -= entry.size;
+    counts.structures[static_cast<std::size_t>(entry.structure)].live -= entry.size;
+    counts.phases[static_cast<std::size_t>(phase.load(std::memory_order_relaxed))].live = counts.total.live;
+  }
+};
+
+// Charges the heap allocations this thread makes while it is alive to
+// `structure` (nested tags win; see AllocationTracker).
+class MemoryTag {
+private:
+  Structure saved;
+
+public:
+  explicit MemoryTag(Structure structure)
+      : saved(AllocationTracker::structure) {
+    AllocationTracker::structure = structure;
+  }
+  MemoryTag(const MemoryTag &) = delete;
+  MemoryTag &operator=(const MemoryTag &) = delete;
+  ~MemoryTag() { AllocationTracker::structure = saved; }
+
+  /// What this thread is allocating for, so a worker thread can carry on under the same tag.
+  static Structure Current() { return AllocationTracker::structure; }
+};
+
+// std::allocator that charges a container's storage to structure S, so
+// containers that grow often are tagged only when they actually allocate.
+template <typename T, Structure S>
+struct TaggedAllocator {
+  using value_type = T;
+  template <typename U>
+  struct rebind {
+    using other = TaggedAllocator<U, S>;
+  };
+
+  TaggedAllocator() = default;
+  template <typename U>
+  TaggedAllocator(const TaggedAllocator<U, S> &) {}
+
+  T *allocate(std::size_t count) {
+    MemoryTag tag(S);
+    return static_cast<T *>(::operator new(count * sizeof(T)));
+  }
+  void deallocate(T *block, std::size_t count) { ::operator delete(block, count * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const TaggedAllocator<U, S> &) const { return true; }
+};
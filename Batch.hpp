@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SourceFile.hpp"
+#include "compiler.hpp"
+#include "error.hpp"
+#include "logger.hpp"
+#include "options.hpp"
+#include "output.hpp"
+
+// Runs many scripts in one process (--batch) on a pool of worker threads.
+// Each script gets its own Compiler and captured stdout/stderr, -v log records
+// included; results are reported in the order the scripts were given, as soon
+// as each is ready:
+//
+//   ==> name.Mc (exit 0) <==     on stdout, followed by what the script printed
+//   ==> name.Mc (exit 1) <==     on stderr, followed by its log and error, if any
+class Batch {
+private:
+  struct Result {
+    std::string out;
+    std::string err;
+    int status = 0;
+    std::atomic<bool> done{false};
+  };
+
+  static void RunOne(const std::string &filename, const Options &options, Result &result) {
+    SourceFile source;
+    if (!source.Open(filename)) {
+      result.err = "ERROR: Unable to open file '" + filename + "'.\n";
+      result.status = 1;
+    } else {
+      result.status = RunCaptured(std::move(source), options, result.out, result.err, filename);
+    }
+    result.done.store(true, std::memory_order_release);
+    result.done.notify_one();
+  }
+
+  /// Append the scripts listed in `manifest` (one per line; blank lines and # comments are skipped).
+  static bool ReadManifest(const std::string &manifest, std::vector<std::string> &files) {
+    std::ifstream in(manifest);
+    if (!in) {
+      std::cout << "ERROR: Unable to open manifest '" << manifest << "'." << std::endl;
+      return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      line.erase(0, line.find_first_not_of(" \t"));
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (!line.empty() && line[0] != '#') {
+        files.push_back(line);
+      }
+    }
+    return true;
+  }
+
+public:
+  /// Compile and run one script on this thread, appending what it prints to
+  /// `out` and its log records and any error to `err`; returns its exit status. `filename` names
+  /// the script's --cache entry (scripts without one are never cached).
+  static int RunCaptured(SourceFile &&source, const Options &options, std::string &out, std::string &err,
+                         const std::string &filename = "") {
+    shouldLog = options.verbose;
+    output.SetCapture(&out);
+    Logger::SetCapture(&err);
+    int status = 0;
+    try {
+      Compiler compiler(std::move(source), options);
+      if (options.cache && !filename.empty()) {
+        compiler.parse(ScriptCache(options.cache_dir), filename);
+      } else {
+        compiler.parse();
+      }
+      compiler.optimize();
+      compiler.execute();
+    } catch (const Err &e) {
+      err += e.what();
+      err += '\n';
+      status = e.Status();
+    } catch (const std::exception &e) {
+      err += "ERROR: ";
+      err += e.what();
+      err += '\n';
+      status = 1;
+    }
+    output.SetCapture(nullptr); // Flushes whatever the script printed into `out`
+    Logger::SetCapture(nullptr);
+    return status;
+  }
+
+  /// Returns 0 if every script succeeded, 1 otherwise.
+  static int Run(const Options &options) {
+    std::vector<std::string> files = options.batch_files;
+    if (!options.manifest.empty() && !ReadManifest(options.manifest, files)) {
+      return 1;
+    }
+    if (files.empty()) {
+      return 0;
+    }
+
+    std::size_t jobs = options.jobs > 0 ? static_cast<std::size_t>(options.jobs)
+                                        : std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min(jobs, files.size());
+
+    auto results = std::make_unique<Result[]>(files.size());
+    std::atomic<std::size_t> next{0};
+    std::vector<std::thread> workers;
+    workers.reserve(jobs);
+    for (std::size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back([&] {
+        for (std::size_t id; (id = next.fetch_add(1, std::memory_order_relaxed)) < files.size();) {
+          RunOne(files[id], options, results[id]);
+        }
+      });
+    }
+
+    std::size_t failed = 0;
+    for (std::size_t id = 0; id < files.size(); ++id) {
+      Result &result = results[id];
+      result.done.wait(false, std::memory_order_acquire);
+      const std::string header = "==> " + files[id] + " (exit " + std::to_string(result.status) + ") <==\n";
+      output.Write(header);
+      output.Write(result.out);
+      if (!result.err.empty()) {
+        output.Flush(); // Keep stdout and stderr in step when both go to a terminal
+        std::cerr << header << result.err << std::flush;
+      }
+      failed += result.status != 0;
+      result.out = std::string(); // Release memory as we go
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    output.Flush();
+
+    std::cerr << "Batch: " << files.size() << " scripts, " << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+  }
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Allocation.hpp"
+#include "ParallelLexer.hpp"
+#include "SourceFile.hpp"
+#include "compiler.hpp"
+#include "lexer.hpp"
+#include "options.hpp"
+#include "output.hpp"
+
+// Runs every phase of the pipeline `runs` times on one script and reports
+// wall-time percentiles, throughput and allocations per phase. Allocations
+// are only counted in builds with MC_TRACK_ALLOCATIONS=1 (see Allocation.hpp);
+// elsewhere their fields are left out of the JSON and empty in the CSV.
+class Benchmark {
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Phase {
+    std::string name;
+    std::string unit;    // What `items` counts
+    std::size_t items = 0;
+    std::size_t input_bytes = 0; // Source bytes read per run, for phases that scan the text
+    std::vector<double> seconds{};
+    std::size_t allocs = 0;
+    std::size_t bytes = 0;
+
+    double Percentile(double fraction) const {
+      std::vector<double> sorted = seconds;
+      std::sort(sorted.begin(), sorted.end());
+      std::size_t rank = static_cast<std::size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+      return sorted[std::max<std::size_t>(rank, 1) - 1];
+    }
+    double Throughput() const {
+      double median = Percentile(0.5);
+      return median > 0 ? static_cast<double>(items) / median : 0.0;
+    }
+    double MegabytesPerSecond() const {
+      double median = Percentile(0.5);
+      return median > 0 ? static_cast<double>(input_bytes) / median / 1e6 : 0.0;
+    }
+  };
+
+  // Times `body` and charges its time and allocations to `phase`.
+  template <typename T>
+  static void Measure(Phase &phase, T &&body) {
+    const std::size_t count_before = alloc_count.load(std::memory_order_relaxed);
+    const std::size_t bytes_before = alloc_bytes.load(std::memory_order_relaxed);
+    const auto start = Clock::now();
+    body();
+    const auto stop = Clock::now();
+    phase.allocs += alloc_count.load(std::memory_order_relaxed) - count_before;
+    phase.bytes += alloc_bytes.load(std::memory_order_relaxed) - bytes_before;
+    phase.seconds.push_back(std::chrono::duration<double>(stop - start).count());
+  }
+
+  static void ReportJSON(const Options &options, std::size_t source_bytes, const std::vector<Phase> &phases) {
+    std::cout << "{\n  \"file\": \"" << options.filename << "\",\n"
+              << "  \"runs\": " << options.bench_runs << ",\n"
+              << "  \"engine\": \"" << (options.engine == Engine::NATIVE ? "jit" : options.engine == Engine::BYTECODE ? "vm" : "tree") << "\",\n"
+              << "  \"opt_level\": " << options.opt_level << ",\n"
+              << "  \"source_bytes\": " << source_bytes << ",\n"
+              << "  \"phases\": [\n";
+    for (std::size_t i = 0; i < phases.size(); ++i) {
+      const Phase &phase = phases[i];
+      const double runs = static_cast<double>(phase.seconds.size());
+      std::cout << "    {\"phase\": \"" << phase.name << "\""
+                << ", \"min_ms\": " << phase.Percentile(0.0) * 1e3
+                << ", \"median_ms\": " << phase.Percentile(0.5) * 1e3
+                << ", \"p99_ms\": " << phase.Percentile(0.99) * 1e3
+                << ", \"" << phase.unit << "\": " << phase.items
+                << ", \"" << phase.unit << "_per_sec\": " << phase.Throughput();
+      if (phase.input_bytes > 0) {
+        std::cout << ", \"mb_per_sec\": " << phase.MegabytesPerSecond();
+      }
+      if (MC_TRACK_ALLOCATIONS) {
+        std::cout << ", \"allocs_per_run\": " << static_cast<double>(phase.allocs) / runs
+                  << ", \"alloc_bytes_per_run\": " << static_cast<double>(phase.bytes) / runs;
+      }
+      std::cout << "}" << (i + 1 < phases.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n}" << std::endl;
+  }
+
+  static void ReportCSV(const std::vector<Phase> &phases) {
+    std::cout << "phase,min_ms,median_ms,p99_ms,unit,items,items_per_sec,allocs_per_run,alloc_bytes_per_run,mb_per_sec\n";
+    for (const Phase &phase : phases) {
+      const double runs = static_cast<double>(phase.seconds.size());
+      std::cout << phase.name << ',' << phase.Percentile(0.0) * 1e3 << ','
+                << phase.Percentile(0.5) * 1e3 << ',' << phase.Percentile(0.99) * 1e3 << ','
+                << phase.unit << ',' << phase.items << ',' << phase.Throughput() << ',';
+      if (MC_TRACK_ALLOCATIONS) {
+        std::cout << static_cast<double>(phase.allocs) / runs << ',' << static_cast<double>(phase.bytes) / runs;
+      } else {
+        std::cout << ',';
+      }
+      std::cout << ',';
+      if (phase.input_bytes > 0) {
+        std::cout << phase.MegabytesPerSecond();
+      }
+      std::cout << '\n';
+    }
+    std::cout << std::flush;
+  }
+
+public:
+  static int Run(const Options &options, std::string_view text) {
+    std::vector<Phase> phases = {
+        {"lex", "tokens"},
+        {"parse", "nodes"},
+        {"optimize", "nodes"},
+        {"lower", "nodes"},
+        {"execute", "nodes"},
+    };
+    if (options.engine == Engine::TREE) {
+      phases.erase(phases.begin() + 3);
+    }
+    Phase &lex = phases[0];
+    Phase &parse = phases[1];
+    Phase &optimize = phases[2];
+    Phase *lower = options.engine != Engine::TREE ? &phases[3] : nullptr; // Includes JIT compilation
+    Phase &execute = phases.back();
+
+    for (int run = 0; run < options.bench_runs; ++run) {
+      // Every run starts from scratch so each phase sees the same input.
+      Interner names;
+      std::vector<emplex::Token> tokens;
+      Measure(lex, [&] {
+        tokens = ParallelLexer::Tokenize(text, &names, static_cast<std::size_t>(options.lex_jobs), options.lex_chunk);
+      });
+      lex.items = tokens.size();
+      lex.input_bytes = text.size();
+
+      Compiler compiler(SourceFile::Borrow(text), tokens, options);
+      Measure(parse, [&] { compiler.parse(); });
+      parse.items = optimize.items = execute.items = compiler.GetNodeCount();
+      Measure(optimize, [&] { compiler.optimize(); });
+      if (lower) {
+        lower->items = compiler.GetNodeCount();
+        Measure(*lower, [&] { compiler.lower(); });
+      }
+
+      // Values are still formatted, but the program's output is not written.
+      output.SetDiscard(true);
+      Measure(execute, [&] { compiler.execute(); output.Flush(); });
+      output.SetDiscard(false);
+    }
+
+    if (options.bench_format == "csv") {
+      ReportCSV(phases);
+    } else {
+      ReportJSON(options, text.size(), phases);
+    }
+    return 0;
+  }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "logger.hpp"
+
+// Flat instruction stream produced from the AST. Values flow through a small
+// operand stack; variables are addressed by their SymbolTable frame slot.
+enum class Op : std::uint8_t {
+  PUSH_CONST, // push constants[arg]
+  LOAD,       // push variable arg
+  STORE,      // pop into variable arg
+  PRINT,      // pop and print one value
+  PRINT_END,  // finish a print statement
+  HALT,
+  // Superinstructions, fused from the pairs above as they are emitted:
+  STORE_CONST, // variable arg = constants[arg2]    (PUSH_CONST; STORE)
+  MOVE,        // variable arg = variable arg2      (LOAD; STORE)
+  PRINT_CONST, // print constants[arg]              (PUSH_CONST; PRINT)
+  PRINT_SLOT,  // print variable arg                (LOAD; PRINT)
+};
+
+struct Instruction {
+  Op op;
+  std::uint32_t arg = 0;
+  std::uint32_t arg2 = 0;
+};
+
+class Bytecode {
+private:
+  std::vector<Instruction> code{};
+  std::vector<double> constants{};
+  std::size_t stack_depth = 0;
+  std::size_t max_stack = 0;
+  std::size_t fused[4] = {}; // Hits per superinstruction, in Op order
+
+  // If the previous instruction is `first`, turn it into `fused_op` (taking `slot` as the target
+  // of a store). Code is straight-line, so no jump can land between the two.
+  bool Fuse(Op first, Op fused_op, bool store, std::uint32_t slot = 0) {
+    if (code.empty() || code.back().op != first) {
+      return false;
+    }
+    Instruction &previous = code.back();
+    previous = store ? Instruction{fused_op, slot, previous.arg} : Instruction{fused_op, previous.arg};
+    ++fused[static_cast<std::size_t>(fused_op) - static_cast<std::size_t>(Op::STORE_CONST)];
+    --stack_depth;
+    return true;
+  }
+
+  void Emit(Op op, std::uint32_t arg = 0) {
+    if ((op == Op::STORE && (Fuse(Op::PUSH_CONST, Op::STORE_CONST, true, arg) || Fuse(Op::LOAD, Op::MOVE, true, arg))) ||
+        (op == Op::PRINT && (Fuse(Op::PUSH_CONST, Op::PRINT_CONST, false) || Fuse(Op::LOAD, Op::PRINT_SLOT, false)))) {
+      return;
+    }
+    code.push_back(Instruction{op, arg});
+    switch (op) {
+      case Op::PUSH_CONST:
+      case Op::LOAD:
+        max_stack = std::max(max_stack, ++stack_depth);
+        break;
+      case Op::STORE:
+      case Op::PRINT:
+        --stack_depth;
+        break;
+      default:
+        break;
+    }
+  }
+
+  std::uint32_t AddConstant(double value) {
+    constants.push_back(value);
+    return static_cast<std::uint32_t>(constants.size() - 1);
+  }
+
+  // Leaves the node's value on top of the stack.
+  void LowerValue(const ASTArena &arena, NodeId id) {
+    const ASTNode &node = arena[id];
+    switch (node.GetType()) {
+      case ASTNode::EXPRESSION:
+        LowerValue(arena, arena.GetChild(node, 0));
+        break;
+      case ASTNode::VARIABLE:
+        Emit(Op::LOAD, static_cast<std::uint32_t>(node.GetId()));
+        break;
+      default: // VALUE, or an EMPTY term that the tree walker leaves at its default value
+        Emit(Op::PUSH_CONST, AddConstant(node.GetValue()));
+        break;
+    }
+  }
+
+  void LowerStatement(const ASTArena &arena, NodeId id) {
+    const ASTNode &node = arena[id];
+    auto children = arena.GetChildren(node);
+    switch (node.GetType()) {
+      case ASTNode::EMPTY:
+      case ASTNode::STATEMENT_BLOCK:
+        for (NodeId statement : children) {
+          LowerStatement(arena, statement);
+        }
+        break;
+      case ASTNode::ASSIGN:
+        LowerValue(arena, children[1]);
+        Emit(Op::STORE, static_cast<std::uint32_t>(arena[children[0]].GetId()));
+        break;
+      case ASTNode::ASSIGN_CONST:
+        Emit(Op::PUSH_CONST, AddConstant(node.GetValue()));
+        Emit(Op::STORE, static_cast<std::uint32_t>(node.GetId()));
+        break;
+      case ASTNode::ASSIGN_SLOT:
+        Emit(Op::LOAD, node.GetOperand());
+        Emit(Op::STORE, static_cast<std::uint32_t>(node.GetId()));
+        break;
+      case ASTNode::PRINT:
+        for (NodeId expression : children) {
+          LowerValue(arena, expression);
+          Emit(Op::PRINT);
+        }
+        Emit(Op::PRINT_END);
+        break;
+      default: // A bare EXPRESSION/VARIABLE/VALUE statement has no effect
+        break;
+    }
+  }
+
+public:
+  static Bytecode Lower(const ASTArena &arena, NodeId root) {
+    Bytecode program;
+    program.LowerStatement(arena, root);
+    program.Emit(Op::HALT);
+    LOG(INFO) << "Superinstructions: store_const " << program.fused[0] << ", move " << program.fused[1]
+              << ", print_const " << program.fused[2] << ", print_slot " << program.fused[3];
+    return program;
+  }
+
+  const std::vector<Instruction> &GetCode() const { return code; }
+  const std::vector<double> &GetConstants() const { return constants; }
+  std::size_t GetMaxStack() const { return max_stack; }
+};
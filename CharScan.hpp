@@ -0,0 +1,131 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MC_HAVE_SSE2 1
+#else
+#define MC_HAVE_SSE2 0
+#endif
+
+// Bulk character scans used by the lexer to get through the long, boring
+// stretches of a script (indentation, comment bodies, identifier and digit
+// runs) 16 bytes at a time. Every function has a scalar tail (and a scalar
+// version when SSE2 is not available) that gives identical results.
+namespace scan {
+
+  constexpr bool IsIdentChar(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  }
+  constexpr bool IsDigit(unsigned char c) { return c >= '0' && c <= '9'; }
+
+#if MC_HAVE_SSE2
+  // Bytes of `v` in [lo, hi]; bytes >= 0x80 compare as negative, so they never match.
+  inline __m128i InRange(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+  }
+
+  inline __m128i Load(const char *text) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(text));
+  }
+
+  inline unsigned Mask(__m128i v) { return static_cast<unsigned>(_mm_movemask_epi8(v)); }
+#endif
+
+  /// First position at or after `pos` that is not ' ', '\t' or '\n'; adds the newlines passed to `lines`.
+  inline std::size_t SkipWhitespace(const char *text, std::size_t pos, std::size_t size, std::size_t &lines) {
+    // Most runs are a single separator; check the next byte before going wide.
+    for (std::size_t lead_end = pos + 2; pos < size && pos < lead_end; ++pos) {
+      const char c = text[pos];
+      if (c == '\n') {
+        ++lines;
+      } else if (c != ' ' && c != '\t') {
+        return pos;
+      }
+    }
+#if MC_HAVE_SSE2
+    for (; pos + 16 <= size; pos += 16) {
+      const __m128i block = Load(text + pos);
+      const unsigned newline = Mask(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+      const unsigned blank = newline | Mask(_mm_cmpeq_epi8(block, _mm_set1_epi8(' '))) |
+                             Mask(_mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+      if (blank != 0xFFFF) {
+        const unsigned run = static_cast<unsigned>(std::countr_one(blank));
+        lines += static_cast<std::size_t>(std::popcount(newline & ((1u << run) - 1)));
+        return pos + run;
+      }
+      lines += static_cast<std::size_t>(std::popcount(newline));
+    }
+#endif
+    for (; pos < size; ++pos) {
+      const char c = text[pos];
+      if (c == '\n') {
+        ++lines;
+      } else if (c != ' ' && c != '\t') {
+        break;
+      }
+    }
+    return pos;
+  }
+
+  /// First position at or after `pos` holding '\n', a control byte below '\t', or a non-ASCII byte.
+  inline std::size_t FindLineEnd(const char *text, std::size_t pos, std::size_t size) {
+#if MC_HAVE_SSE2
+    for (; pos + 16 <= size; pos += 16) {
+      const __m128i block = Load(text + pos);
+      const unsigned stop = Mask(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))) |
+                            Mask(_mm_cmplt_epi8(block, _mm_set1_epi8('\t'))); // Also catches bytes >= 0x80
+      if (stop != 0) {
+        return pos + static_cast<std::size_t>(std::countr_zero(stop));
+      }
+    }
+#endif
+    for (; pos < size; ++pos) {
+      const signed char c = static_cast<signed char>(text[pos]);
+      if (c == '\n' || c < '\t') {
+        break;
+      }
+    }
+    return pos;
+  }
+
+  /// First position at or after `pos` that is not [A-Za-z0-9_].
+  inline std::size_t SkipIdentChars(const char *text, std::size_t pos, std::size_t size) {
+#if MC_HAVE_SSE2
+    for (; pos + 16 <= size; pos += 16) {
+      const __m128i block = Load(text + pos);
+      const __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20)); // Fold A-Z onto a-z
+      const unsigned ident = Mask(_mm_or_si128(_mm_or_si128(InRange(block, '0', '9'), InRange(lower, 'a', 'z')),
+                                               _mm_cmpeq_epi8(block, _mm_set1_epi8('_'))));
+      if (ident != 0xFFFF) {
+        return pos + static_cast<std::size_t>(std::countr_one(ident));
+      }
+    }
+#endif
+    while (pos < size && IsIdentChar(static_cast<unsigned char>(text[pos]))) {
+      ++pos;
+    }
+    return pos;
+  }
+
+  /// First position at or after `pos` that is not [0-9].
+  inline std::size_t SkipDigits(const char *text, std::size_t pos, std::size_t size) {
+#if MC_HAVE_SSE2
+    for (; pos + 16 <= size; pos += 16) {
+      const unsigned digits = Mask(InRange(Load(text + pos), '0', '9'));
+      if (digits != 0xFFFF) {
+        return pos + static_cast<std::size_t>(std::countr_one(digits));
+      }
+    }
+#endif
+    while (pos < size && IsDigit(static_cast<unsigned char>(text[pos]))) {
+      ++pos;
+    }
+    return pos;
+  }
+
+} // namespace scan
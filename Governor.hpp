@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#include "ASTNode.hpp"
+#include "SymbolTable.hpp"
+#include "error.hpp"
+#include "options.hpp"
+
+// Resource limits for running untrusted scripts (--max-steps, --timeout,
+// --max-mem). The program runs on the tree walker with a statement loop
+// that only decrements a counter per statement; every CHECK_INTERVAL
+// statements, starting with the first (parsing may already have used up
+// the memory allowance), or sooner when the step budget runs out, it checks
+// the budget, the elapsed execution time and the process's current resident
+// memory. That is measured now rather than as the peak, which never comes
+// down, so in --batch and --serve one large script cannot fail every script
+// after it (scripts running at the same time do count against each other).
+// Crossing a limit throws LimitErr, naming the statement's line, and the
+// script exits with LimitErr::EXIT_STATUS.
+class Governor {
+private:
+  static constexpr std::uint64_t CHECK_INTERVAL = 4096;
+
+  ASTArena &arena;
+  SymbolTable &symbols;
+  const Options &options;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::uint64_t steps = 0;      // Statements run before the current countdown began
+  std::uint64_t countdown = 0;  // Statements left until the next Check (the first statement checks)
+  std::uint64_t interval = 0;   // What `countdown` was last reset to
+
+  Governor(ASTArena &arena, SymbolTable &symbols, const Options &options)
+      : arena(arena), symbols(symbols), options(options) {}
+
+  /// Current resident set of the whole process, in bytes (0 if unknown).
+  static std::uint64_t ResidentMemory() {
+#if defined(__linux__)
+    // "size resident shared ..." in pages
+    char text[128];
+    const int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) {
+      return 0;
+    }
+    const ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) {
+      return 0;
+    }
+    text[length] = '\0';
+    unsigned long long size = 0, resident = 0;
+    if (std::sscanf(text, "%llu %llu", &size, &resident) != 2) {
+      return 0;
+    }
+    return static_cast<std::uint64_t>(resident) * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info{};
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) !=
+        KERN_SUCCESS) {
+      return 0;
+    }
+    return static_cast<std::uint64_t>(info.resident_size);
+#else
+    return 0;
+#endif
+  }
+
+  void Check(std::size_t line) {
+    steps += interval;
+    if (options.max_steps > 0 && steps >= options.max_steps) {
+      throw LimitErr(line, "step budget of " + std::to_string(options.max_steps) + " statements used up");
+    }
+    if (options.timeout > 0.0) {
+      const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (elapsed >= options.timeout) {
+        char text[64];
+        std::snprintf(text, sizeof(text), "ran for %.3f s, over the %g s timeout", elapsed, options.timeout);
+        throw LimitErr(line, text);
+      }
+    }
+    if (options.max_mem_mb > 0) {
+      const std::uint64_t resident = ResidentMemory();
+      if (resident > options.max_mem_mb * 1024 * 1024) {
+        throw LimitErr(line, "memory use reached " + std::to_string(resident >> 20) + " MB, over the " +
+                                 std::to_string(options.max_mem_mb) + " MB cap");
+      }
+    }
+    interval = CHECK_INTERVAL;
+    if (options.max_steps > 0) {
+      interval = std::min(interval, options.max_steps - steps);
+    }
+    countdown = interval;
+  }
+
+  void WalkBlock(NodeId block) {
+    for (NodeId id : arena.GetChildren(block)) {
+      ASTNode &node = arena[id];
+      if (node.GetType() == ASTNode::EMPTY || node.GetType() == ASTNode::STATEMENT_BLOCK) {
+        WalkBlock(id);
+        continue;
+      }
+      if (countdown-- == 0) {
+        Check(node.GetLine());
+        --countdown;
+      }
+      node.Run(arena, symbols);
+    }
+  }
+
+public:
+  /// True if any limit is set.
+  static bool Enabled(const Options &options) {
+    return options.max_steps > 0 || options.timeout > 0.0 || options.max_mem_mb > 0;
+  }
+
+  /// Run the program under `root` on the tree walker within `options`' limits.
+  static void Run(ASTArena &arena, NodeId root, SymbolTable &symbols, const Options &options) {
+    Governor governor(arena, symbols, options);
+    governor.WalkBlock(root);
+  }
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Allocation.hpp"
+
+// Small dense integer standing in for an identifier's text.
+using Symbol = std::uint32_t;
+
+// Maps identifier text to Symbols. Each distinct name is copied once into
+// block storage, so interning a name that was already seen allocates nothing.
+class Interner {
+private:
+  static constexpr std::size_t BLOCK_SIZE = 4096;
+
+  std::unordered_map<std::string_view, Symbol> ids{}; // Keys view into blocks
+  std::vector<std::string_view> names{};              // Indexed by Symbol
+  std::vector<std::unique_ptr<char[]>> blocks{};
+  char *current_block = nullptr; // Block that short names are packed into
+  std::size_t block_used = BLOCK_SIZE;
+
+  std::string_view Store(std::string_view text) {
+    char *out;
+    if (text.size() > BLOCK_SIZE / 4) {
+      // Long names get a block of their own rather than wasting a shared one.
+      blocks.push_back(std::make_unique<char[]>(text.size()));
+      out = blocks.back().get();
+    } else {
+      if (current_block == nullptr || block_used + text.size() > BLOCK_SIZE) {
+        blocks.push_back(std::make_unique<char[]>(BLOCK_SIZE));
+        current_block = blocks.back().get();
+        block_used = 0;
+      }
+      out = current_block + block_used;
+      block_used += text.size();
+    }
+    std::memcpy(out, text.data(), text.size());
+    return {out, text.size()};
+  }
+
+public:
+  Interner() = default;
+  Interner(const Interner &) = delete;
+  Interner &operator=(const Interner &) = delete;
+
+  Symbol Intern(std::string_view text) {
+    auto it = ids.find(text);
+    if (it != ids.end()) {
+      return it->second;
+    }
+    MemoryTag tag(Structure::INTERNER);
+    std::string_view stored = Store(text);
+    Symbol symbol = static_cast<Symbol>(names.size());
+    names.push_back(stored);
+    ids.emplace(stored, symbol);
+    return symbol;
+  }
+
+  std::string_view GetName(Symbol symbol) const { return names[symbol]; }
+  std::size_t size() const { return names.size(); }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#define MC_HAVE_JIT 1
+#else
+#define MC_HAVE_JIT 0
+#endif
+
+#include "Bytecode.hpp"
+#include "SymbolTable.hpp"
+#include "logger.hpp"
+#include "output.hpp"
+
+// Native back end (--jit): translates a lowered Bytecode program into x86-64
+// machine code. Operand stack entry i lives in register xmm<i>, variables
+// stay in their frame slots and constants are read from the program's
+// constant table, so the generated code does no dispatch at all. Prints call
+// back into OutputBuffer. Programs the translator cannot handle (or builds
+// for other targets) are run on the VM instead.
+class JIT {
+private:
+  using Entry = void (*)(double *frame, const double *constants, OutputBuffer *out);
+
+  static constexpr std::size_t MAX_DEPTH = 16; // xmm0-xmm15
+
+  void *code = nullptr;
+  std::size_t code_size = 0;
+  std::size_t entry = 0; // Offset of the function, after the call stubs
+
+  JIT(void *code, std::size_t size, std::size_t entry)
+      : code(code), code_size(size), entry(entry) {}
+
+  static void WriteValue(OutputBuffer *out, double value) { out->Write(value); }
+  static void EndLine(OutputBuffer *out) { out->EndLine(); }
+
+#if MC_HAVE_JIT
+  // Just enough of an x86-64 encoder for the code below.
+  class Assembler {
+  private:
+    std::vector<std::uint8_t> bytes{};
+
+    void Emit(std::initializer_list<std::uint8_t> values) { bytes.insert(bytes.end(), values); }
+    void Emit32(std::uint32_t value) {
+      for (int i = 0; i < 4; ++i) {
+        bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+      }
+    }
+
+    // movsd with a [base + disp] operand; base is rbx or rbp, so no SIB byte is needed.
+    void MovsdMemory(std::uint8_t opcode, unsigned xmm, unsigned base, std::uint32_t disp) {
+      bytes.push_back(0xF2);
+      if (xmm >= 8) {
+        bytes.push_back(0x44); // REX.R
+      }
+      const bool short_disp = disp < 0x80; // Most programs touch few slots; keep the code small
+      Emit({0x0F, opcode, static_cast<std::uint8_t>((short_disp ? 0x40 : 0x80) | ((xmm & 7) << 3) | base)});
+      if (short_disp) {
+        bytes.push_back(static_cast<std::uint8_t>(disp));
+      } else {
+        Emit32(disp);
+      }
+    }
+
+  public:
+    explicit Assembler(std::size_t expected_size) { bytes.reserve(expected_size); }
+
+    static constexpr unsigned RBX = 3; // frame
+    static constexpr unsigned RBP = 5; // constants
+
+    void Prologue() {
+      Emit({0x53, 0x55, 0x41, 0x54}); // push rbx; push rbp; push r12 (leaves rsp 16-byte aligned)
+      Emit({0x48, 0x89, 0xFB});       // mov rbx, rdi
+      Emit({0x48, 0x89, 0xF5});       // mov rbp, rsi
+      Emit({0x49, 0x89, 0xD4});       // mov r12, rdx
+    }
+    void Epilogue() {
+      Emit({0x41, 0x5C, 0x5D, 0x5B, 0xC3}); // pop r12; pop rbp; pop rbx; ret
+    }
+    void Load(unsigned xmm, unsigned base, std::uint32_t disp) { MovsdMemory(0x10, xmm, base, disp); }
+    void Store(unsigned xmm, unsigned base, std::uint32_t disp) { MovsdMemory(0x11, xmm, base, disp); }
+    void MoveToXmm0(unsigned xmm) {
+      if (xmm == 0) {
+        return;
+      }
+      bytes.push_back(0xF2);
+      if (xmm >= 8) {
+        bytes.push_back(0x41); // REX.B
+      }
+      Emit({0x0F, 0x10, static_cast<std::uint8_t>(0xC0 | (xmm & 7))}); // movsd xmm0, xmm<n>
+    }
+    /// Emit a stub that tail-calls `target(out, ...)`; returns its offset for Call().
+    std::size_t Stub(const void *target) {
+      const std::size_t offset = bytes.size();
+      Emit({0x4C, 0x89, 0xE7}); // mov rdi, r12
+      Emit({0x48, 0xB8});       // mov rax, imm64
+      std::uint64_t address = reinterpret_cast<std::uint64_t>(target);
+      for (int i = 0; i < 8; ++i) {
+        bytes.push_back(static_cast<std::uint8_t>(address >> (8 * i)));
+      }
+      Emit({0xFF, 0xE0}); // jmp rax
+      return offset;
+    }
+    /// Direct call to a stub; every xmm register is clobbered. Call sites use rel32 rather than an
+    /// indirect call so each one is predicted without needing a branch target buffer entry.
+    void Call(std::size_t stub) {
+      bytes.push_back(0xE8);
+      Emit32(static_cast<std::uint32_t>(static_cast<std::int64_t>(stub) - static_cast<std::int64_t>(bytes.size() + 4)));
+    }
+    std::size_t Size() const { return bytes.size(); }
+
+    const std::vector<std::uint8_t> &GetBytes() const { return bytes; }
+  };
+
+  // Byte offset of element `index` of a double array, if it fits a disp32.
+  static bool Displacement(std::uint32_t index, std::uint32_t &disp) {
+    if (index >= (std::uint32_t(1) << 28)) {
+      return false;
+    }
+    disp = index * sizeof(double);
+    return true;
+  }
+
+  // Emit the code for `program`; it is entered at byte `entry`.
+  static bool Translate(const Bytecode &program, Assembler &as, std::size_t &entry, const char *&reason) {
+    const std::size_t write_value = as.Stub(reinterpret_cast<const void *>(&WriteValue));
+    const std::size_t end_line = as.Stub(reinterpret_cast<const void *>(&EndLine));
+    entry = as.Size();
+    as.Prologue();
+    std::size_t depth = 0;
+    std::uint32_t disp = 0;
+    std::uint32_t target = 0;
+    for (const Instruction &instruction : program.GetCode()) {
+      switch (instruction.op) {
+        case Op::PUSH_CONST:
+        case Op::LOAD:
+          if (depth == MAX_DEPTH) {
+            reason = "operand stack deeper than the SSE register file";
+            return false;
+          }
+          if (!Displacement(instruction.arg, disp)) {
+            reason = "slot out of range";
+            return false;
+          }
+          as.Load(static_cast<unsigned>(depth++), instruction.op == Op::LOAD ? Assembler::RBX : Assembler::RBP, disp);
+          break;
+        case Op::STORE:
+          if (!Displacement(instruction.arg, disp)) {
+            reason = "slot out of range";
+            return false;
+          }
+          as.Store(static_cast<unsigned>(--depth), Assembler::RBX, disp);
+          break;
+        case Op::PRINT:
+          if (depth != 1) {
+            reason = "value live across a call";
+            return false;
+          }
+          as.MoveToXmm0(static_cast<unsigned>(--depth));
+          as.Call(write_value);
+          break;
+        case Op::PRINT_END:
+          if (depth != 0) {
+            reason = "value live across a call";
+            return false;
+          }
+          as.Call(end_line);
+          break;
+        case Op::HALT:
+          as.Epilogue();
+          return true;
+        case Op::STORE_CONST:
+        case Op::MOVE:
+          if (depth == MAX_DEPTH) {
+            reason = "operand stack deeper than the SSE register file";
+            return false;
+          }
+          if (!Displacement(instruction.arg2, disp) || !Displacement(instruction.arg, target)) {
+            reason = "slot out of range";
+            return false;
+          }
+          as.Load(static_cast<unsigned>(depth), instruction.op == Op::MOVE ? Assembler::RBX : Assembler::RBP, disp);
+          as.Store(static_cast<unsigned>(depth), Assembler::RBX, target);
+          break;
+        case Op::PRINT_CONST:
+        case Op::PRINT_SLOT:
+          if (depth != 0) {
+            reason = "value live across a call";
+            return false;
+          }
+          if (!Displacement(instruction.arg, disp)) {
+            reason = "slot out of range";
+            return false;
+          }
+          as.Load(0, instruction.op == Op::PRINT_SLOT ? Assembler::RBX : Assembler::RBP, disp);
+          as.Call(write_value);
+          break;
+      }
+    }
+    reason = "program does not end in HALT";
+    return false;
+  }
+#endif
+
+public:
+  JIT(const JIT &) = delete;
+  JIT &operator=(const JIT &) = delete;
+  JIT(JIT &&other) noexcept
+      : code(std::exchange(other.code, nullptr)), code_size(std::exchange(other.code_size, 0)), entry(other.entry) {}
+  JIT &operator=(JIT &&other) noexcept {
+    std::swap(code, other.code);
+    std::swap(code_size, other.code_size);
+    std::swap(entry, other.entry);
+    return *this;
+  }
+  ~JIT() {
+#if MC_HAVE_JIT
+    if (code != nullptr) {
+      munmap(code, code_size);
+    }
+#endif
+  }
+
+  /// Machine code for `program`, or nothing (with the reason logged) if it must run on the VM.
+  static std::optional<JIT> Compile(const Bytecode &program) {
+#if MC_HAVE_JIT
+    Assembler as(program.GetCode().size() * 8 + 64);
+    std::size_t entry = 0;
+    const char *reason = "program too large for rel32 calls";
+    if (program.GetCode().size() > (std::size_t(1) << 26) || !Translate(program, as, entry, reason)) {
+      LOG(INFO) << "JIT fallback to the VM: " << reason;
+      return std::nullopt;
+    }
+    const std::vector<std::uint8_t> &bytes = as.GetBytes();
+    // Write the code while the pages are writable, then make them executable only.
+    void *pages = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) {
+      LOG(INFO) << "JIT fallback to the VM: unable to map code pages";
+      return std::nullopt;
+    }
+    std::memcpy(pages, bytes.data(), bytes.size());
+    if (mprotect(pages, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+      munmap(pages, bytes.size());
+      LOG(INFO) << "JIT fallback to the VM: unable to make code executable";
+      return std::nullopt;
+    }
+    LOG(INFO) << "JIT compiled " << program.GetCode().size() << " instructions to " << bytes.size() << " bytes";
+    return JIT(pages, bytes.size(), entry);
+#else
+    (void)program;
+    LOG(INFO) << "JIT fallback to the VM: no native back end for this target";
+    return std::nullopt;
+#endif
+  }
+
+  /// Run the code compiled from `program` on `symbols`' frame.
+  void Run(const Bytecode &program, SymbolTable &symbols) const {
+    reinterpret_cast<Entry>(static_cast<char *>(code) + entry)(symbols.GetFrame(), program.GetConstants().data(), &output);
+  }
+};
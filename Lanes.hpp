@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "error.hpp"
+#include "options.hpp"
+#include "output.hpp"
+
+// Build the lane loops for AVX-512 and AVX2 as well, and pick one when the
+// program loads (GNU ifunc); elsewhere they are built for the baseline ISA only.
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define MC_LANE_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MC_LANE_KERNEL
+#endif
+
+// Lane-parallel evaluation (--bind=name=values). Every binding gives a
+// top-level variable one value per lane, replacing what its declaration
+// assigns, and the program runs once for all lanes: the frame holds a row of
+// lane values per slot, so each statement costs one dispatch and then a plain
+// loop over the row that the compiler turns into vector instructions. Scripts
+// have no branches, so lanes never diverge and need no masks, and which slots
+// vary between lanes is known exactly while lowering: a slot holding the same
+// value in every lane is written and printed once, in lane 0, and only values
+// that depend on a binding cost a row. Lanes run a chunk at a time, with the
+// chunk sized to keep the frame cache-resident, and each lane's output is
+// collected on its own and printed after a
+//   ==> n=27 <==
+// header, in lane order.
+class Lanes {
+public:
+  static constexpr NodeId NO_BIND_POINT = UINT32_MAX;
+
+private:
+  static constexpr std::size_t WIDTH = 8;              // Doubles in an AVX-512 register; chunks are a multiple of it
+  static constexpr std::size_t CHUNK_BYTES = 1 << 20;  // Frame size a chunk aims for
+  static constexpr std::size_t MAX_CHUNK = 1024;
+  static constexpr std::uint32_t CONSTANT = UINT32_MAX; // Operand slot of a literal
+
+  // A value a statement reads: a slot's row, or a literal.
+  struct Operand {
+    std::uint32_t slot = CONSTANT;
+    double value = 0.0;
+    bool varying = false; // The slot may differ between lanes
+  };
+
+  struct Op {
+    enum Kind : std::uint8_t { SET, COPY, BIND, PRINT };
+    Kind kind = SET;
+    std::uint32_t target = 0; // Slot written by SET, COPY and BIND
+    std::uint32_t source = 0; // COPY: slot read; BIND: binding; PRINT: first of `operands`
+    std::uint32_t count = 0;  // PRINT: operands
+    double value = 0.0;       // SET
+    bool varying = false;     // COPY and BIND: write the whole row, not just lane 0
+  };
+
+  const ASTArena &arena;
+  std::span<const Binding> bindings;
+  std::vector<std::uint32_t> binding_of; // By NodeId; CONSTANT unless the statement is a bind point
+  std::vector<bool> varying;             // By slot, at the point Lower has reached
+  std::vector<Op> ops;
+  std::vector<Operand> operands;
+
+  Lanes(const ASTArena &arena, std::size_t frame_size, std::span<const Binding> bindings)
+      : arena(arena), bindings(bindings), binding_of(arena.size(), CONSTANT), varying(frame_size, false) {}
+
+  MC_LANE_KERNEL static void Copy(double *row, const double *from, std::size_t lanes) {
+    for (std::size_t i = 0; i < lanes; ++i) {
+      row[i] = from[i];
+    }
+  }
+
+  Operand Term(NodeId id) const {
+    const ASTNode &node = arena[id];
+    switch (node.GetType()) {
+      case ASTNode::VARIABLE:
+        return {static_cast<std::uint32_t>(node.GetId()), 0.0, varying[node.GetId()]};
+      case ASTNode::EXPRESSION:
+        return Term(arena.GetChild(node, 0));
+      default:
+        return {CONSTANT, node.GetValue(), false}; // VALUE, or a missing term (reads as 0)
+    }
+  }
+
+  void Assign(std::size_t target, Operand value) {
+    Op op;
+    op.target = static_cast<std::uint32_t>(target);
+    if (value.slot == CONSTANT) {
+      op.kind = Op::SET;
+      op.value = value.value;
+    } else if (value.slot != target) {
+      op.kind = Op::COPY;
+      op.source = value.slot;
+      op.varying = value.varying;
+    } else {
+      return; // x = x
+    }
+    varying[target] = op.varying;
+    ops.push_back(op);
+  }
+
+  void Lower(NodeId id) {
+    const ASTNode &node = arena[id];
+    auto children = arena.GetChildren(node);
+    if (binding_of[id] != CONSTANT) {
+      const std::size_t target = arena[children[0]].GetId();
+      varying[target] = bindings[binding_of[id]].values.size() > 1;
+      ops.push_back({Op::BIND, static_cast<std::uint32_t>(target), binding_of[id], 0, 0.0, varying[target]});
+      return;
+    }
+    switch (node.GetType()) {
+      case ASTNode::EMPTY:
+      case ASTNode::STATEMENT_BLOCK:
+        for (NodeId statement : children) {
+          Lower(statement);
+        }
+        break;
+      case ASTNode::ASSIGN:
+        Assign(arena[children[0]].GetId(), Term(children[1]));
+        break;
+      case ASTNode::ASSIGN_CONST:
+        Assign(node.GetId(), {CONSTANT, node.GetValue(), false});
+        break;
+      case ASTNode::ASSIGN_SLOT:
+        Assign(node.GetId(), Operand{node.GetOperand(), 0.0, varying[node.GetOperand()]});
+        break;
+      case ASTNode::PRINT: {
+        Op op{Op::PRINT, 0, static_cast<std::uint32_t>(operands.size()), static_cast<std::uint32_t>(children.size()), 0.0, false};
+        for (NodeId item : children) {
+          operands.push_back(Term(item));
+        }
+        ops.push_back(op);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  /// Lanes per chunk: as many as keep the frame near CHUNK_BYTES, a multiple of WIDTH.
+  static std::size_t ChunkSize(std::size_t frame_size, std::size_t lane_count) {
+    const std::size_t fit = CHUNK_BYTES / (std::max<std::size_t>(frame_size, 1) * sizeof(double)) / WIDTH * WIDTH;
+    const std::size_t needed = (lane_count + WIDTH - 1) / WIDTH * WIDTH;
+    return std::min(std::clamp(fit, WIDTH, MAX_CHUNK), needed);
+  }
+
+  std::string Header(std::size_t lane) const {
+    std::string header = "==>";
+    char number[OutputBuffer::NUMBER_SIZE];
+    for (const Binding &binding : bindings) {
+      const double value = binding.values[binding.values.size() == 1 ? 0 : lane];
+      header += ' ';
+      header += binding.name;
+      header += '=';
+      header.append(number, OutputBuffer::Format(number, value));
+    }
+    header += " <==\n";
+    return header;
+  }
+
+  void Execute(std::size_t frame_size) const {
+    std::size_t lane_count = 1;
+    for (const Binding &binding : bindings) {
+      lane_count = std::max(lane_count, binding.values.size());
+    }
+    const std::size_t chunk = ChunkSize(frame_size, lane_count);
+
+    // Every binding's values, one per lane and padded to whole chunks, so BIND is a row copy.
+    const std::size_t padded = (lane_count + chunk - 1) / chunk * chunk;
+    std::vector<std::vector<double>> lane_values;
+    for (const Binding &binding : bindings) {
+      std::vector<double> &values = lane_values.emplace_back(padded, binding.values.back());
+      if (binding.values.size() > 1) {
+        std::copy(binding.values.begin(), binding.values.end(), values.begin());
+      }
+    }
+
+    std::vector<double> frame(frame_size * chunk);
+    std::vector<std::string> text(chunk);
+    char number[OutputBuffer::NUMBER_SIZE];
+    for (std::size_t first = 0; first < lane_count; first += chunk) {
+      const std::size_t lanes = std::min(chunk, lane_count - first);
+      std::fill(frame.begin(), frame.end(), 0.0);
+      for (const Op &op : ops) {
+        double *row = frame.data() + op.target * chunk;
+        switch (op.kind) {
+          case Op::SET:
+            *row = op.value;
+            break;
+          case Op::COPY:
+            Copy(row, frame.data() + op.source * chunk, op.varying ? chunk : 1);
+            break;
+          case Op::BIND:
+            Copy(row, lane_values[op.source].data() + first, op.varying ? chunk : 1);
+            break;
+          case Op::PRINT:
+            // Item by item, so a value every lane shares is formatted once.
+            for (const Operand &item : std::span(operands.data() + op.source, op.count)) {
+              if (item.varying) {
+                const double *values = frame.data() + item.slot * chunk;
+                for (std::size_t lane = 0; lane < lanes; ++lane) {
+                  text[lane].append(number, OutputBuffer::Format(number, values[lane]));
+                }
+                continue;
+              }
+              char *end = OutputBuffer::Format(number, item.slot == CONSTANT ? item.value : frame[item.slot * chunk]);
+              for (std::size_t lane = 0; lane < lanes; ++lane) {
+                text[lane].append(number, end);
+              }
+            }
+            for (std::size_t lane = 0; lane < lanes; ++lane) {
+              text[lane] += '\n';
+            }
+            break;
+        }
+      }
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        output.Write(Header(first + lane));
+        output.Write(text[lane]);
+        text[lane].clear();
+      }
+    }
+  }
+
+public:
+  /// Run the program under `root` once per lane of `bindings`, where `bind_points`
+  /// holds the top-level declaration of each bound variable.
+  static void Run(const ASTArena &arena, NodeId root, std::size_t frame_size, std::span<const NodeId> bind_points,
+                  std::span<const Binding> bindings) {
+    Lanes lanes(arena, frame_size, bindings);
+    for (std::size_t i = 0; i < bind_points.size(); ++i) {
+      if (bind_points[i] == NO_BIND_POINT) {
+        throw UsageErr("--bind names '" + bindings[i].name + "', which is not declared at the top level of the script.");
+      }
+      lanes.binding_of[bind_points[i]] = static_cast<std::uint32_t>(i);
+    }
+    lanes.Lower(root);
+    lanes.Execute(frame_size);
+  }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Allocation.hpp"
+#include "ScriptCache.hpp"
+#include "SourceFile.hpp"
+#include "compiler.hpp"
+#include "options.hpp"
+#include "output.hpp"
+
+// Heap accounting for one run of a script (--mem-report[=file]). The script
+// runs as usual with the AllocationTracker on, moving through the phases
+// lex, parse, optimize, lower and execute; lexing happens during parsing
+// unless --lex-jobs lexes the input up front, and the lower phase is empty
+// unless the program runs as bytecode. At exit, after the program's output,
+// the allocations, bytes, peak and final live bytes for every phase and every
+// owning structure go to stderr, and the same numbers are written to `file`
+// as "key value" lines in a fixed order (no timings), so two builds can be diffed.
+class MemoryReport {
+private:
+  static void Row(const char *name, const MemoryCounters &counters) {
+    char row[112];
+    std::snprintf(row, sizeof(row), "  %-10s %12llu %15llu %15llu %15llu\n", name,
+                  static_cast<unsigned long long>(counters.allocs), static_cast<unsigned long long>(counters.bytes),
+                  static_cast<unsigned long long>(counters.peak), static_cast<unsigned long long>(counters.live));
+    std::cerr << row;
+  }
+
+  static void Write(std::ofstream &out, const std::string &key, const MemoryCounters &counters) {
+    out << key << ".allocs " << counters.allocs << '\n'
+        << key << ".bytes " << counters.bytes << '\n'
+        << key << ".live " << counters.live << '\n'
+        << key << ".peak " << counters.peak << '\n';
+  }
+
+  static void Report(const MemoryCounts &counts, const std::string &summary_path) {
+    std::cerr << "Memory: " << counts.total.allocs << " allocations, " << counts.total.bytes << " bytes, peak "
+              << counts.total.peak << " bytes live\n"
+              << "  phase            allocs           bytes       peak live      live after\n";
+    for (std::size_t i = 0; i < static_cast<std::size_t>(MemoryPhase::COUNT); ++i) {
+      Row(AllocationTracker::PhaseName(static_cast<MemoryPhase>(i)), counts.phases[i]);
+    }
+    std::cerr << "  structure        allocs           bytes       peak live      live after\n";
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Structure::COUNT); ++i) {
+      Row(AllocationTracker::StructureName(static_cast<Structure>(i)), counts.structures[i]);
+    }
+
+    std::ofstream out(summary_path);
+    for (std::size_t i = 0; i < static_cast<std::size_t>(MemoryPhase::COUNT); ++i) {
+      Write(out, std::string("phase.") + AllocationTracker::PhaseName(static_cast<MemoryPhase>(i)), counts.phases[i]);
+    }
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Structure::COUNT); ++i) {
+      Write(out, std::string("structure.") + AllocationTracker::StructureName(static_cast<Structure>(i)),
+            counts.structures[i]);
+    }
+    Write(out, "total", counts.total);
+    if (out) {
+      std::cerr << "Memory summary written to " << summary_path << std::endl;
+    } else {
+      std::cerr << "ERROR: Unable to write '" << summary_path << "'." << std::endl;
+    }
+  }
+
+public:
+  /// Run the script in `source` as main would, then report its heap use.
+  static int Run(const Options &options, SourceFile &&source) {
+    if (!MC_TRACK_ALLOCATIONS) {
+      std::cout << "ERROR: --mem-report needs a build with allocation tracking (make tracked)." << std::endl;
+      return 1;
+    }
+    if (!AllocationTracker::Start(MemoryPhase::LEX)) {
+      std::cout << "ERROR: Unable to start memory tracking." << std::endl;
+      return 1;
+    }
+    MemoryCounts counts;
+    {
+      Compiler compiler(std::move(source), options); // Lexes the whole input here with --lex-jobs
+      AllocationTracker::SetPhase(MemoryPhase::PARSE);
+      if (options.cache) {
+        compiler.parse(ScriptCache(options.cache_dir), options.filename);
+      } else {
+        compiler.parse();
+      }
+      AllocationTracker::SetPhase(MemoryPhase::OPTIMIZE);
+      compiler.optimize();
+      AllocationTracker::SetPhase(MemoryPhase::LOWER);
+      if (compiler.RunsBytecode()) {
+        compiler.lower();
+      }
+      AllocationTracker::SetPhase(MemoryPhase::EXECUTE);
+      compiler.execute();
+      output.Flush();
+      counts = AllocationTracker::Read(); // While the compiler still holds everything
+    }
+    AllocationTracker::Stop();
+    Report(counts, options.mem_report_file);
+    return 0;
+  }
+};
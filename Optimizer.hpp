@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "logger.hpp"
+
+// AST-to-AST rewrites run between parsing and execution.
+//   -O0  no changes
+//   -O1  fold constant expressions and propagate constants through
+//        straight-line code, so reads of variables with a known value
+//        become literals
+// Every rewrite reproduces exactly the double the unoptimized program
+// would have computed, so output is unchanged at every level.
+class Optimizer {
+private:
+  ASTArena &arena;
+  std::vector<double> known_value;
+  std::vector<bool> is_known;
+  std::size_t folded = 0;
+
+  Optimizer(ASTArena &arena, std::size_t frame_size)
+      : arena(arena), known_value(frame_size), is_known(frame_size, false) {}
+
+  /// Simplify an expression in place; returns true if it is now a VALUE node.
+  bool FoldValue(NodeId id) {
+    ASTNode &node = arena[id];
+    switch (node.GetType()) {
+      case ASTNode::VALUE:
+        return true;
+      case ASTNode::VARIABLE:
+        if (is_known[node.GetId()]) {
+          arena.ReplaceWithValue(id, known_value[node.GetId()]);
+          ++folded;
+          return true;
+        }
+        return false;
+      case ASTNode::EXPRESSION: {
+        NodeId term = arena.GetChild(node, 0);
+        if (FoldValue(term)) {
+          arena.ReplaceWithValue(id, arena[term].GetValue());
+          ++folded;
+          return true;
+        }
+        return false;
+      }
+      default:
+        return false;
+    }
+  }
+
+  void FoldStatement(NodeId id) {
+    ASTNode &node = arena[id];
+    auto children = arena.GetChildren(node);
+    switch (node.GetType()) {
+      case ASTNode::EMPTY:
+      case ASTNode::STATEMENT_BLOCK:
+        for (NodeId statement : children) {
+          FoldStatement(statement);
+        }
+        break;
+      case ASTNode::ASSIGN: {
+        const std::size_t slot = arena[children[0]].GetId();
+        is_known[slot] = FoldValue(children[1]);
+        known_value[slot] = arena[children[1]].GetValue();
+        break;
+      }
+      case ASTNode::PRINT:
+        for (NodeId expression : children) {
+          FoldValue(expression);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+public:
+  static void Run(ASTArena &arena, NodeId root, int level, std::size_t frame_size) {
+    if (level <= 0) {
+      return;
+    }
+    Optimizer optimizer(arena, frame_size);
+    optimizer.FoldStatement(root);
+    LOG(INFO) << "Optimizer (-O" << level << ") folded " << optimizer.folded << " nodes";
+  }
+};
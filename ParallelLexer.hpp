@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Allocation.hpp"
+#include "Interner.hpp"
+#include "Scanner.hpp"
+#include "lexer.hpp"
+
+// Tokenizes a large input on several threads (--lex-jobs=N) and produces
+// exactly the token vector that Lexer::Tokenize would, symbols included.
+//
+// The input is cut into chunks just after newlines. Each chunk is lexed on
+// its own thread as if a token started at its first byte, with a private
+// Interner and lines counted from 1. The chunks are then stitched in order:
+// a chunk's tokens are trusted from the first one that also starts a token
+// in the true stream, because from there on the lexer is in the same state
+// (its position). Anything before that point, such as the rest of a string
+// that runs past the cut, is re-lexed sequentially. Lines are shifted by
+// the newlines before the chunk, and local symbols are remapped into the
+// shared Interner in order of first use, as a sequential run assigns them.
+class ParallelLexer {
+private:
+  static constexpr Symbol UNMAPPED = static_cast<Symbol>(-1);
+
+  struct Chunk {
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    std::size_t newlines = 0;            // '\n' bytes in [begin, end)
+    Interner names{};                    // Local symbols for `tokens`
+    std::size_t used_names = 0;          // Local symbols referenced by `tokens`
+    std::vector<emplex::Token> tokens{}; // Tokens starting in [begin, end), lexed as if from `begin`
+
+    // Filled in while stitching:
+    std::vector<emplex::Token> fixed{}; // True tokens re-lexed ahead of `keep_from`
+    std::size_t keep_from = 0;          // First entry of `tokens` that is in the true stream
+    std::vector<Symbol> global{};       // Local symbol -> shared symbol
+    std::size_t line_offset = 0;        // Newlines before `begin`
+    std::size_t out_offset = 0;         // Where this chunk's tokens go in the result
+  };
+
+  static std::size_t Offset(std::string_view text, const emplex::Token &token) {
+    return static_cast<std::size_t>(token.lexeme.data() - text.data());
+  }
+
+  static std::size_t LineAfter(const emplex::Token &token) {
+    return token.line_id + static_cast<std::size_t>(std::count(token.lexeme.begin(), token.lexeme.end(), '\n'));
+  }
+
+  static void LexChunk(std::string_view text, Chunk &chunk, bool intern) {
+    chunk.newlines = static_cast<std::size_t>(std::count(text.begin() + chunk.begin, text.begin() + chunk.end, '\n'));
+    Scanner scanner;
+    if (intern) {
+      scanner.SetInterner(&chunk.names);
+    }
+    scanner.Seek(chunk.begin, 1);
+    chunk.tokens.reserve((chunk.end - chunk.begin) / 8);
+    for (;;) {
+      const std::size_t names_before = chunk.names.size();
+      emplex::Token token = scanner.NextSignificantToken(text);
+      if (!token || Offset(text, token) >= chunk.end) {
+        chunk.used_names = names_before; // Ignore a name first seen in the token we dropped
+        break;
+      }
+      chunk.tokens.push_back(token);
+    }
+  }
+
+  // Find where the true stream, standing at (pos, line), joins `chunk`'s tokens; returns the new (pos, line).
+  static void Stitch(std::string_view text, Chunk &chunk, std::size_t &pos, std::size_t &line) {
+    Scanner scanner;
+    scanner.Seek(pos, line);
+    chunk.keep_from = chunk.tokens.size();
+    while (emplex::Token token = scanner.NextSignificantToken(text)) {
+      const std::size_t start = Offset(text, token);
+      if (start >= chunk.end) {
+        break; // Belongs to a later chunk; it will be lexed again from (pos, line)
+      }
+      auto match = std::lower_bound(chunk.tokens.begin(), chunk.tokens.end(), start,
+                                    [&](const emplex::Token &t, std::size_t at) { return Offset(text, t) < at; });
+      if (match != chunk.tokens.end() && Offset(text, *match) == start) {
+        chunk.keep_from = static_cast<std::size_t>(match - chunk.tokens.begin());
+        break;
+      }
+      chunk.fixed.push_back(token);
+      pos = start + token.lexeme.size();
+      line = LineAfter(token);
+    }
+    if (chunk.keep_from < chunk.tokens.size()) {
+      const emplex::Token &last = chunk.tokens.back();
+      pos = Offset(text, last) + last.lexeme.size();
+      line = LineAfter(last) + chunk.line_offset;
+    }
+  }
+
+  // Give each local symbol its shared number, in the order a sequential lexer would have met the names.
+  static void MapSymbols(Chunk &chunk, Interner &interner) {
+    for (emplex::Token &token : chunk.fixed) {
+      if (token.id == emplex::Lexer::ID_ID) {
+        token.symbol = interner.Intern(token.lexeme);
+      }
+    }
+    chunk.global.assign(chunk.used_names, UNMAPPED);
+    if (chunk.keep_from == 0) {
+      // Every local name is used, and local numbers are already in order of first use.
+      for (Symbol local = 0; local < chunk.used_names; ++local) {
+        chunk.global[local] = interner.Intern(chunk.names.GetName(local));
+      }
+      return;
+    }
+    for (std::size_t i = chunk.keep_from; i < chunk.tokens.size(); ++i) {
+      const emplex::Token &token = chunk.tokens[i];
+      if (token.id == emplex::Lexer::ID_ID && chunk.global[token.symbol] == UNMAPPED) {
+        chunk.global[token.symbol] = interner.Intern(token.lexeme);
+      }
+    }
+  }
+
+  static void Emit(const Chunk &chunk, bool intern, std::vector<emplex::Token> &out) {
+    emplex::Token *to = out.data() + chunk.out_offset;
+    to = std::copy(chunk.fixed.begin(), chunk.fixed.end(), to);
+    for (std::size_t i = chunk.keep_from; i < chunk.tokens.size(); ++i) {
+      emplex::Token token = chunk.tokens[i];
+      token.line_id += chunk.line_offset;
+      if (intern && token.id == emplex::Lexer::ID_ID) {
+        token.symbol = chunk.global[token.symbol];
+      }
+      *to++ = token;
+    }
+  }
+
+  // Run body(i) for every chunk, using the calling thread for chunk 0.
+  template <typename T>
+  static void ForEachChunk(std::size_t count, T &&body) {
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < count; ++i) {
+      workers.emplace_back([&body, i, structure = MemoryTag::Current()] {
+        MemoryTag tag(structure);
+        body(i);
+      });
+    }
+    body(0);
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+public:
+  /// Tokenize `text` with up to `jobs` threads, each taking at least `min_chunk` bytes.
+  static std::vector<emplex::Token> Tokenize(std::string_view text, Interner *interner, std::size_t jobs,
+                                             std::size_t min_chunk = std::size_t(1) << 20) {
+    MemoryTag tag(Structure::TOKENS);
+    const std::size_t count = std::min(jobs, text.size() / std::max<std::size_t>(min_chunk, 1));
+    if (count <= 1) {
+      Scanner scanner;
+      scanner.SetInterner(interner);
+      return scanner.Tokenize(text);
+    }
+
+    // Cut just after the first newline at or past each even split point.
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    for (std::size_t i = 1, begin = 0; begin < text.size(); ++i) {
+      std::size_t end = text.size();
+      if (i < count) {
+        end = text.find('\n', std::max(begin, text.size() / count * i));
+        end = end == std::string_view::npos ? text.size() : end + 1;
+      }
+      chunks.push_back(std::make_unique<Chunk>());
+      chunks.back()->begin = begin;
+      chunks.back()->end = end;
+      begin = end;
+    }
+
+    const bool intern = interner != nullptr;
+    ForEachChunk(chunks.size(), [&](std::size_t i) { LexChunk(text, *chunks[i], intern); });
+
+    std::size_t pos = 0;
+    std::size_t line = 1;
+    std::size_t newlines = 0;
+    std::size_t total = 0;
+    for (std::unique_ptr<Chunk> &chunk : chunks) {
+      chunk->line_offset = newlines;
+      newlines += chunk->newlines;
+      Stitch(text, *chunk, pos, line);
+      if (intern) {
+        MapSymbols(*chunk, *interner);
+      }
+      chunk->out_offset = total;
+      total += chunk->fixed.size() + chunk->tokens.size() - chunk->keep_from;
+    }
+
+    std::vector<emplex::Token> out(total);
+    ForEachChunk(chunks.size(), [&](std::size_t i) { Emit(*chunks[i], intern, out); });
+    return out;
+  }
+};
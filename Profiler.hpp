@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <sys/time.h>
+#define MC_HAVE_SIGPROF 1
+#else
+#define MC_HAVE_SIGPROF 0
+#endif
+
+#include "ASTNode.hpp"
+#include "SymbolTable.hpp"
+#include "output.hpp"
+
+// Per-line execution profile (--profile[=file]). The program runs on the
+// tree walker, with the statement loop replaced by one that counts every
+// block and statement it enters. Time is sampled rather than measured: a
+// SIGPROF timer fires every SAMPLE_INTERVAL_US of CPU time and charges the
+// statement running at that moment, so the cost per statement is one
+// counter increment and one store. At exit the hot lines and node-type
+// counts are printed to stderr, and the samples are written as folded
+// stacks (block nesting, then the statement) for flamegraph tools.
+class Profiler {
+private:
+  static constexpr long SAMPLE_INTERVAL_US = 100;
+
+  // Shared with the signal handler; only one profile runs at a time (see ParseOptions).
+  static inline std::atomic<NodeId> current{0};
+  static inline std::atomic<std::uint32_t *> sample_slots{nullptr};
+
+  ASTArena &arena;
+  SymbolTable &symbols;
+  std::vector<std::uint64_t> counts;  // Times each node was entered as a block or statement
+  std::vector<std::uint32_t> samples; // SIGPROF ticks charged to each statement
+
+  Profiler(ASTArena &arena, SymbolTable &symbols)
+      : arena(arena), symbols(symbols), counts(arena.size()), samples(arena.size()) {}
+
+#if MC_HAVE_SIGPROF
+  static void OnSample(int) {
+    if (std::uint32_t *slots = sample_slots.load(std::memory_order_relaxed)) {
+      ++slots[current.load(std::memory_order_relaxed)];
+    }
+  }
+#endif
+
+  static bool IsBlock(const ASTNode &node) {
+    return node.GetType() == ASTNode::EMPTY || node.GetType() == ASTNode::STATEMENT_BLOCK;
+  }
+
+  void Walk(NodeId id) {
+    ASTNode &node = arena[id];
+    ++counts[id];
+    if (IsBlock(node)) {
+      for (NodeId child : arena.GetChildren(node)) {
+        Walk(child);
+      }
+      return;
+    }
+    current.store(id, std::memory_order_relaxed);
+    node.Run(arena, symbols);
+  }
+
+  // Add `times` visits for every node under statement `id` (statements have no branches).
+  void CountTypes(NodeId id, std::uint64_t times, std::vector<std::uint64_t> &by_type) const {
+    const ASTNode &node = arena[id];
+    by_type[node.GetType()] += times;
+    for (NodeId child : arena.GetChildren(node)) {
+      CountTypes(child, times, by_type);
+    }
+  }
+
+  std::string Frame(NodeId id) const {
+    const ASTNode &node = arena[id];
+    char frame[64];
+    std::snprintf(frame, sizeof(frame), "%s@%zu", ASTNode::TypeName(node.GetType()), node.GetLine());
+    return frame;
+  }
+
+  // Folded-stack weight of every statement under `id`, keyed by "main;<enclosing blocks>;<statement>".
+  void Fold(NodeId id, const std::string &stack, bool use_samples, std::map<std::string, std::uint64_t> &folded) const {
+    for (NodeId child : arena.GetChildren(id)) {
+      if (IsBlock(arena[child])) {
+        if (counts[child] > 0) {
+          Fold(child, stack + ";" + Frame(child), use_samples, folded);
+        }
+      } else if (const std::uint64_t weight = use_samples ? samples[child] : counts[child]; weight > 0) {
+        folded[stack + ";" + Frame(child)] += weight;
+      }
+    }
+  }
+
+  void Report(NodeId root, const std::string &folded_path) const {
+    struct Line {
+      std::size_t line = 0;
+      std::uint64_t count = 0;
+      std::uint64_t samples = 0;
+    };
+    std::vector<Line> lines; // Indexed by line number
+    std::vector<std::uint64_t> by_type(ASTNode::TYPE_COUNT);
+    std::uint64_t statements = 0;
+    std::uint64_t total_samples = 0;
+    for (NodeId id = 0; id < counts.size(); ++id) {
+      if (counts[id] == 0) {
+        continue;
+      }
+      const ASTNode &node = arena[id];
+      if (IsBlock(node)) {
+        by_type[node.GetType()] += counts[id];
+        continue;
+      }
+      statements += counts[id];
+      total_samples += samples[id];
+      CountTypes(id, counts[id], by_type);
+      if (node.GetLine() >= lines.size()) {
+        lines.resize(node.GetLine() + 1);
+      }
+      Line &line = lines[node.GetLine()];
+      line.line = node.GetLine();
+      line.count += counts[id];
+      line.samples += samples[id];
+    }
+
+    std::vector<Line> hot;
+    std::copy_if(lines.begin(), lines.end(), std::back_inserter(hot), [](const Line &line) { return line.count > 0; });
+    const std::size_t shown = std::min<std::size_t>(hot.size(), 20);
+    std::partial_sort(hot.begin(), hot.begin() + static_cast<std::ptrdiff_t>(shown), hot.end(), [](const Line &a, const Line &b) {
+      return a.samples != b.samples ? a.samples > b.samples : a.count != b.count ? a.count > b.count : a.line < b.line;
+    });
+
+    std::cerr << "Profile: " << statements << " statements executed, " << total_samples << " samples of "
+              << SAMPLE_INTERVAL_US << " us\n"
+              << "Hot lines:\n"
+              << "      line         count   samples    time\n";
+    char row[96];
+    for (std::size_t i = 0; i < shown; ++i) {
+      const double share = total_samples > 0 ? 100.0 * static_cast<double>(hot[i].samples) / static_cast<double>(total_samples) : 0.0;
+      std::snprintf(row, sizeof(row), "%10zu %13llu %9llu  %5.1f%%\n", hot[i].line,
+                    static_cast<unsigned long long>(hot[i].count), static_cast<unsigned long long>(hot[i].samples), share);
+      std::cerr << row;
+    }
+    std::cerr << "Node types:\n";
+    for (std::size_t type = 0; type < by_type.size(); ++type) {
+      if (by_type[type] > 0) {
+        std::snprintf(row, sizeof(row), "  %-16s %13llu\n", ASTNode::TypeName(static_cast<ASTNode::Type>(type)),
+                      static_cast<unsigned long long>(by_type[type]));
+        std::cerr << row;
+      }
+    }
+
+    // A run too short for any samples still gets a usable graph, weighted by executions.
+    std::map<std::string, std::uint64_t> folded;
+    Fold(root, "main", total_samples > 0, folded);
+    std::ofstream out(folded_path);
+    for (const auto &[stack, weight] : folded) {
+      out << stack << ' ' << weight << '\n';
+    }
+    if (out) {
+      std::cerr << "Folded stacks (" << (total_samples > 0 ? "samples" : "executions") << ") written to "
+                << folded_path << std::endl;
+    } else {
+      std::cerr << "ERROR: Unable to write '" << folded_path << "'." << std::endl;
+    }
+  }
+
+public:
+  /// Run the program under `root` on the tree walker, then report where its time went.
+  static void Run(ASTArena &arena, NodeId root, SymbolTable &symbols, const std::string &folded_path) {
+    Profiler profiler(arena, symbols);
+#if MC_HAVE_SIGPROF
+    sample_slots = profiler.samples.data();
+    current.store(root, std::memory_order_relaxed);
+    struct sigaction action {};
+    action.sa_handler = OnSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+    itimerval timer{{0, SAMPLE_INTERVAL_US}, {0, SAMPLE_INTERVAL_US}};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+    profiler.Walk(root);
+#if MC_HAVE_SIGPROF
+    // The handler stays installed: a tick may still be pending on another thread.
+    timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sample_slots.store(nullptr, std::memory_order_relaxed);
+#endif
+    output.Flush(); // Program output first, then the report
+    profiler.Report(root, folded_path);
+  }
+};
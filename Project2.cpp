@@ -5,37 +5,65 @@
 #include <unordered_map>
 #include <vector>
 
+#include "Batch.hpp"
+#include "Benchmark.hpp"
+#include "MemoryReport.hpp"
+#include "Server.hpp"
+#include "SourceFile.hpp"
+#include "Watch.hpp"
 #include "compiler.hpp"
 #include "error.hpp"
 #include "logger.hpp"
-
-extern bool shouldLog;
+#include "options.hpp"
+#include "output.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    std::cout << "Format: " << argv[0] << " [filename]" << std::endl;
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage(argv[0]);
     exit(1);
   }
 
-  shouldLog = false;
+  shouldLog = options.verbose; // The log goes to stderr and log.txt, apart from program output
 
-  if (argc == 3 && argv[2] == std::string("-v")) {
-    shouldLog = true;
+  if (options.batch) {
+    return Batch::Run(options);
+  }
+  if (!options.serve_socket.empty()) {
+    return Server::Run(options);
+  }
+  if (options.watch) {
+    return Watcher::Run(options);
   }
 
-  std::string filename = argv[1];
+  std::string filename = options.filename;
 
-  std::ifstream in_file(filename); // Load the input file
-  if (in_file.fail()) {
+  SourceFile source; // Load (memory-map) the input file
+  if (!source.Open(filename)) {
     std::cout << "ERROR: Unable to open file '" << filename << "'." << std::endl;
     exit(1);
   }
 
-  auto compiler = Compiler(in_file);
   try {
-    compiler.parse();
+    if (options.bench_runs > 0) {
+      return Benchmark::Run(options, source.Text());
+    }
+    if (options.mem_report) {
+      return MemoryReport::Run(options, std::move(source));
+    }
+
+    auto compiler = Compiler(std::move(source), options);
+    if (options.cache) {
+      compiler.parse(ScriptCache(options.cache_dir), filename);
+    } else {
+      compiler.parse();
+    }
+    compiler.optimize();
     compiler.execute();
+    output.Flush();
   } catch (const Err &e) {
-    exit(1);
+    output.Flush(); // Keep what the script printed before it stopped
+    std::cerr << e.what() << std::endl;
+    exit(e.Status());
   }
 }
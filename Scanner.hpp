@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "CharScan.hpp"
+#include "Interner.hpp"
+#include "lexer.hpp"
+
+// The generated emplex::DFA, compressed for scanning: input bytes that every
+// state treats alike share one column, and states, stops and classes are
+// single bytes, so the whole table is about 1 KB. It is derived from the DFA
+// at compile time, so regenerating lexer.hpp keeps the two in step.
+class CompactDFA {
+public:
+  static constexpr int MAX_CLASSES = 32;
+  using DFA = emplex::DFA;
+
+  struct Tables {
+    std::array<std::uint8_t, 128> char_class{};
+    std::array<std::array<std::int8_t, MAX_CLASSES>, DFA::size()> next{};
+    std::array<std::uint8_t, DFA::size()> stop{};     // Stop id on entering each state
+    std::array<std::uint8_t, DFA::size()> eol_stop{}; // Stop id if the line ends right after
+    std::array<bool, DFA::size()> ident_loop{};       // State repeats on every [A-Za-z0-9_]
+    std::array<bool, DFA::size()> digit_loop{};       // State repeats on every [0-9]
+    std::int8_t line_start = 0;                       // State after DFA::SYMBOL_START
+    int num_classes = 0;
+  };
+
+private:
+  static constexpr bool LoopsOn(int state, bool (*member)(unsigned char)) {
+    for (int c = 0; c < 128; ++c) {
+      if (member(static_cast<unsigned char>(c)) && DFA::GetNext(state, c) != state) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static constexpr Tables Build() {
+    Tables tables;
+    std::array<int, MAX_CLASSES> representative{};
+    for (int c = 0; c < 128; ++c) {
+      int cls = 0;
+      for (; cls < tables.num_classes; ++cls) {
+        bool same = true;
+        for (int state = 0; state < static_cast<int>(DFA::size()) && same; ++state) {
+          same = DFA::GetNext(state, c) == DFA::GetNext(state, representative[cls]);
+        }
+        if (same) {
+          break;
+        }
+      }
+      if (cls == tables.num_classes) {
+        if (cls == MAX_CLASSES) {
+          throw "CompactDFA: raise MAX_CLASSES"; // Fails constant evaluation
+        }
+        representative[cls] = c;
+        ++tables.num_classes;
+      }
+      tables.char_class[c] = static_cast<std::uint8_t>(cls);
+    }
+    for (int state = 0; state < static_cast<int>(DFA::size()); ++state) {
+      for (int cls = 0; cls < tables.num_classes; ++cls) {
+        tables.next[state][cls] = static_cast<std::int8_t>(DFA::GetNext(state, representative[cls]));
+      }
+      tables.stop[state] = static_cast<std::uint8_t>(DFA::GetStop(state));
+      tables.eol_stop[state] = static_cast<std::uint8_t>(DFA::GetStop(DFA::GetNext(state, DFA::SYMBOL_STOP)));
+      tables.ident_loop[state] = LoopsOn(state, [](unsigned char c) { return scan::IsIdentChar(c); });
+      tables.digit_loop[state] = LoopsOn(state, [](unsigned char c) { return scan::IsDigit(c); });
+    }
+    tables.line_start = static_cast<std::int8_t>(DFA::GetNext(0, DFA::SYMBOL_START));
+    return tables;
+  }
+
+public:
+  static const Tables tables;
+  static_assert(DFA::size() <= 127, "States must fit in std::int8_t");
+};
+inline constexpr CompactDFA::Tables CompactDFA::tables = CompactDFA::Build();
+
+// Drop-in for emplex::Lexer that scans with CompactDFA, consumes runs that keep
+// the DFA in one state in bulk, and skips whitespace and // comments with
+// CharScan.hpp. It produces exactly the tokens emplex::Lexer does.
+class Scanner {
+private:
+  using Lexer = emplex::Lexer;
+  using Token = emplex::Token;
+
+  std::size_t cur_line = 1;     // Line of the input at pos
+  std::size_t pos = 0;          // Start of the next lexeme
+  Interner *interner = nullptr; // Symbol table for ID lexemes, if any
+
+public:
+  /// Continue scanning at byte `at` of the input, which is on line `line`.
+  void Seek(std::size_t at, std::size_t line) {
+    pos = at;
+    cur_line = line;
+  }
+
+  /// Intern ID lexemes into this table from now on.
+  void SetInterner(Interner *table) { interner = table; }
+
+  /// Next token of `in`, ignored ones included (EOF has id 0); same as Lexer::NextToken.
+  Token NextToken(std::string_view in) {
+    const char *text = in.data();
+    const std::size_t size = in.size();
+    const CompactDFA::Tables &dfa = CompactDFA::tables;
+
+    if (pos >= size)
+      return {0, "", cur_line};
+
+    std::size_t cur_pos = pos;  // Position in the input that we are actively analyzing
+    std::size_t best_pos = pos; // Best look-ahead we've found so far
+    int cur_state = 0;          // Next state for the DFA analysis
+    int best_stop = -1;         // Best stop state found so far?
+
+    // At the start of a line the DFA first sees DFA::SYMBOL_START.
+    if (pos == 0 || text[pos - 1] == '\n') {
+      cur_state = dfa.line_start;
+    }
+
+    // Record a possible stop after the input up to cur_pos, including the end-of-line look-ahead.
+    auto accept = [&]() {
+      if (dfa.stop[cur_state] > 0) {
+        best_pos = cur_pos;
+        best_stop = dfa.stop[cur_state];
+      }
+      if ((cur_pos == size || text[cur_pos] == '\n') && dfa.eol_stop[cur_state] > 0) {
+        best_pos = cur_pos;
+        best_stop = dfa.eol_stop[cur_state];
+      }
+    };
+
+    while (cur_pos < size) {
+      const unsigned char next_char = static_cast<unsigned char>(text[cur_pos++]);
+      if (next_char >= 128)
+        break; // Ignore invalid chars.
+      cur_state = dfa.next[cur_state][dfa.char_class[next_char]];
+      if (cur_state < 0)
+        break;
+      accept();
+      // Identifier and number bodies leave the state unchanged; skip to their end.
+      std::size_t run_end = cur_pos;
+      if (dfa.ident_loop[cur_state]) {
+        run_end = scan::SkipIdentChars(text, cur_pos, size);
+      } else if (dfa.digit_loop[cur_state]) {
+        run_end = scan::SkipDigits(text, cur_pos, size);
+      }
+      if (run_end != cur_pos) {
+        cur_pos = run_end;
+        accept();
+      }
+    }
+
+    // If we did not find any options, peel off just one character and use it as id.
+    if (best_pos == pos) {
+      best_stop = text[pos];
+      best_pos++;
+    }
+
+    const std::string_view lexeme = in.substr(pos, best_pos - pos);
+    pos = best_pos;
+
+    const std::size_t out_line = cur_line;
+    if (best_stop != Lexer::ID_ID && best_stop != Lexer::ID_NUMBER) {
+      cur_line += static_cast<std::size_t>(std::count(lexeme.begin(), lexeme.end(), '\n'));
+    }
+
+    if (best_stop == Lexer::ID_ID && interner != nullptr) {
+      return {best_stop, lexeme, out_line, interner->Intern(lexeme)};
+    }
+    return {best_stop, lexeme, out_line};
+  }
+
+  /// Skip whitespace and // comments in bulk, as if their (ignored) tokens had been read one by one.
+  void SkipIgnored(std::string_view in) {
+    const char *text = in.data();
+    const std::size_t size = in.size();
+    while (pos < size) {
+      const char c = text[pos];
+      if (c == ' ' || c == '\t' || c == '\n') {
+        pos = scan::SkipWhitespace(text, pos, size, cur_line);
+        if (pos < size && static_cast<unsigned char>(text[pos]) < '\t') {
+          // Control bytes extend the whitespace token before them; let NextToken lex that one.
+          --pos;
+          cur_line -= text[pos] == '\n';
+          break;
+        }
+      } else if (c == '/' && pos + 1 < size && text[pos + 1] == '/') {
+        // A comment runs to the end of the line or the first non-ASCII byte. Control bytes
+        // have their own rules in the DFA, so leave any comment containing one to NextToken.
+        const std::size_t end = scan::FindLineEnd(text, pos + 2, size);
+        if (end < size && text[end] != '\n' && static_cast<unsigned char>(text[end]) < 128) {
+          break;
+        }
+        pos = end;
+      } else {
+        break;
+      }
+    }
+  }
+
+  /// Next token that Lexer::IgnoreToken does not skip (or EOF).
+  Token NextSignificantToken(std::string_view in) {
+    for (;;) {
+      SkipIgnored(in);
+      Token token = NextToken(in);
+      if (!token || !Lexer::IgnoreToken(token.id))
+        return token;
+    }
+  }
+
+  /// The significant tokens of `in`; same as Lexer::Tokenize.
+  std::vector<Token> Tokenize(std::string_view in) {
+    Seek(0, 1);
+    std::vector<Token> out_tokens;
+    out_tokens.reserve(in.size() / 8); // Typical scripts average a token per few bytes
+    while (Token token = NextSignificantToken(in)) {
+      out_tokens.push_back(token);
+    }
+    return out_tokens;
+  }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "ASTNode.hpp"
+#include "SourceFile.hpp"
+#include "logger.hpp"
+
+// On-disk cache of parsed programs (--cache[=dir]). Each script has one
+// entry, named after a hash of its absolute path, holding the resolved AST
+// (node array with variable slots, child index array, root and frame size).
+// An entry is only used when the format version, node size and the hash of
+// the source text match; otherwise it is rebuilt after parsing. The cache
+// directory may be shared, so a matching entry is still checked node by node
+// (see ASTArena::IsRunnable) before the engines, which do no bounds checks,
+// get to run it.
+class ScriptCache {
+private:
+  // Bump whenever ASTNode's layout or the meaning of its fields changes.
+  static constexpr std::uint32_t FORMAT_VERSION = 2;
+
+  struct Header {
+    char magic[8];
+    std::uint32_t format;
+    std::uint32_t node_size;
+    std::uint64_t source_hash;
+    std::uint64_t source_size;
+    std::uint64_t root;
+    std::uint64_t node_count;
+    std::uint64_t child_count;
+    std::uint64_t frame_size;
+  };
+  static constexpr char MAGIC[8] = {'M', 'C', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+  static_assert(std::is_trivially_copyable_v<ASTNode>, "Cached nodes are stored as raw bytes");
+  static_assert(sizeof(Header) % alignof(ASTNode) == 0);
+  static_assert(sizeof(ASTNode) % alignof(NodeId) == 0);
+
+  std::filesystem::path directory;
+
+  /// 64-bit hash of `text`, a word at a time (keys the cache, not security).
+  static std::uint64_t Hash(std::string_view text) {
+    std::uint64_t hash = 0x9e3779b97f4a7c15ull ^ text.size();
+    std::size_t pos = 0;
+    auto mix = [&hash](std::uint64_t word) {
+      hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+      hash ^= hash >> 32;
+    };
+    for (; pos + 8 <= text.size(); pos += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, text.data() + pos, 8);
+      mix(word);
+    }
+    if (pos < text.size()) {
+      std::uint64_t tail = 0;
+      std::memcpy(&tail, text.data() + pos, text.size() - pos);
+      mix(tail);
+    }
+    return hash;
+  }
+
+  std::filesystem::path EntryPath(const std::string &source_path) const {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(source_path, error);
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mcc",
+                  static_cast<unsigned long long>(Hash((error ? source_path : absolute.string()))));
+    return directory / name;
+  }
+
+public:
+  explicit ScriptCache(std::string dir)
+      : directory(dir.empty() ? DefaultDirectory() : std::move(dir)) {}
+
+  /// $XDG_CACHE_HOME/macrocalc, ~/.cache/macrocalc, or .macrocalc-cache in the working directory.
+  static std::string DefaultDirectory() {
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+      return std::string(xdg) + "/macrocalc";
+    }
+    if (const char *home = std::getenv("HOME"); home && *home) {
+      return std::string(home) + "/.cache/macrocalc";
+    }
+    return ".macrocalc-cache";
+  }
+
+  /// Fill `arena` from the entry for `source_path` if it matches `text`; returns false on a miss.
+  bool Load(const std::string &source_path, std::string_view text, ASTArena &arena, NodeId &root,
+            std::size_t &frame_size) const {
+    const std::filesystem::path path = EntryPath(source_path);
+    SourceFile entry; // Memory-mapped, like scripts
+    if (!entry.Open(path.string())) {
+      LOG(INFO) << "Cache miss for " << source_path;
+      return false;
+    }
+    const std::string_view bytes = entry.Text();
+    Header header;
+    if (bytes.size() < sizeof(header)) {
+      LOG(INFO) << "Cache invalidated for " << source_path << " (truncated entry)";
+      return false;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.format != FORMAT_VERSION ||
+        header.node_size != sizeof(ASTNode)) {
+      LOG(INFO) << "Cache invalidated for " << source_path << " (interpreter changed)";
+      return false;
+    }
+    if (header.source_size != text.size() || header.source_hash != Hash(text)) {
+      LOG(INFO) << "Cache invalidated for " << source_path << " (source changed)";
+      return false;
+    }
+    // Divide rather than multiply, so huge counts cannot wrap around to a matching size.
+    const std::size_t body = bytes.size() - sizeof(header);
+    const std::size_t nodes_bytes = header.node_count <= body / sizeof(ASTNode) ? header.node_count * sizeof(ASTNode) : 0;
+    const std::size_t children_bytes = body - nodes_bytes;
+    if (header.node_count > body / sizeof(ASTNode) || header.node_count > UINT32_MAX ||
+        children_bytes % sizeof(NodeId) != 0 || header.child_count != children_bytes / sizeof(NodeId)) {
+      LOG(INFO) << "Cache invalidated for " << source_path << " (truncated entry)";
+      return false;
+    }
+
+    const char *data = bytes.data() + sizeof(header);
+    const std::span nodes(reinterpret_cast<const ASTNode *>(data), header.node_count);
+    const std::span children(reinterpret_cast<const NodeId *>(data + nodes_bytes), header.child_count);
+    // Every slot belongs to a declaration, which needs a node of its own.
+    if (header.root >= header.node_count || header.frame_size > header.node_count ||
+        !ASTArena::IsRunnable(nodes, children, static_cast<NodeId>(header.root), header.frame_size)) {
+      LOG(INFO) << "Cache invalidated for " << source_path << " (corrupt entry)";
+      return false;
+    }
+    arena.Assign(nodes, children);
+    root = static_cast<NodeId>(header.root);
+    frame_size = header.frame_size;
+    LOG(INFO) << "Cache hit for " << source_path << " (" << header.node_count << " nodes)";
+    return true;
+  }
+
+  /// Write (or replace) the entry for `source_path`. Failing to write only costs the next run a parse.
+  void Store(const std::string &source_path, std::string_view text, const ASTArena &arena, NodeId root,
+             std::size_t frame_size) const {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    const std::filesystem::path path = EntryPath(source_path);
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.format = FORMAT_VERSION;
+    header.source_hash = Hash(text);
+    header.source_size = text.size();
+    header.node_size = sizeof(ASTNode);
+    header.root = root;
+    header.node_count = arena.GetNodes().size();
+    header.child_count = arena.GetChildIds().size();
+    header.frame_size = frame_size;
+
+    // Write to a private name and rename, so concurrent runs never see half an entry.
+    unsigned long long process = 0;
+#if defined(__unix__) || defined(__APPLE__)
+    process = static_cast<unsigned long long>(getpid());
+#endif
+    char suffix[48];
+    std::snprintf(suffix, sizeof(suffix), ".%llx.%zx", process,
+                  std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    std::filesystem::path temp = path;
+    temp += suffix;
+    {
+      std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      out.write(reinterpret_cast<const char *>(arena.GetNodes().data()),
+                static_cast<std::streamsize>(arena.GetNodes().size_bytes()));
+      out.write(reinterpret_cast<const char *>(arena.GetChildIds().data()),
+                static_cast<std::streamsize>(arena.GetChildIds().size_bytes()));
+      if (!out) {
+        std::filesystem::remove(temp, error);
+        return;
+      }
+    }
+    std::filesystem::rename(temp, path, error);
+    if (error) {
+      std::filesystem::remove(temp, error);
+      return;
+    }
+    LOG(INFO) << "Cache stored for " << source_path;
+  }
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define MC_HAVE_UNIX_SOCKETS 1
+#else
+#define MC_HAVE_UNIX_SOCKETS 0
+#endif
+
+#include "Batch.hpp"
+#include "SourceFile.hpp"
+#include "options.hpp"
+
+// Persistent evaluation daemon (--serve <socket>). Listens on a Unix domain
+// socket and runs the scripts sent to it, one isolated Compiler per script,
+// with the server's flags (-O, --vm, ...). A connection may carry any number
+// of requests:
+//
+//   request:   <script bytes>\n<script text>
+//   response:  <exit status> <stdout bytes> <stderr bytes>\n<stdout><stderr>
+//
+// The main thread polls every open connection and hands one with a request
+// waiting to a worker thread, which reads that single request, runs it,
+// answers and gives the connection back; idle clients hold no worker. A client
+// that stops sending in the middle of a request is dropped after READ_TIMEOUT.
+// Script errors are reported in the response and never stop the server.
+class Server {
+private:
+  static constexpr std::size_t MAX_SCRIPT = std::size_t(64) << 20;
+  static constexpr int READ_TIMEOUT = 10; // Seconds
+
+#if MC_HAVE_UNIX_SOCKETS
+  static inline char socket_path[sizeof(sockaddr_un::sun_path)] = {};
+
+  static void OnSignal(int) {
+    unlink(socket_path);
+    _exit(0);
+  }
+
+  // Buffered reads from one client connection.
+  class Connection {
+  private:
+    int fd;
+    char buffer[1 << 16];
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    bool Fill() {
+      for (;;) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) {
+          continue;
+        }
+        begin = 0;
+        end = count > 0 ? static_cast<std::size_t>(count) : 0;
+        return count > 0;
+      }
+    }
+
+  public:
+    explicit Connection(int fd)
+        : fd(fd) {}
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+    ~Connection() { close(fd); }
+
+    int Descriptor() const { return fd; }
+    /// True if bytes of the next request were already read, so poll() would not report them.
+    bool HasBuffered() const { return begin < end; }
+
+    /// Read the "<bytes>\n" header of the next request; false at end of stream or on garbage.
+    bool ReadLength(std::size_t &length) {
+      length = 0;
+      for (std::size_t digits = 0;; ++digits) {
+        if (begin == end && !Fill()) {
+          return false;
+        }
+        char c = buffer[begin++];
+        if (c == '\n') {
+          return digits > 0;
+        }
+        if (c < '0' || c > '9' || digits == 19) {
+          return false;
+        }
+        length = length * 10 + static_cast<std::size_t>(c - '0');
+      }
+    }
+
+    bool ReadExact(std::size_t length, std::vector<char> &bytes) {
+      bytes.resize(length);
+      for (std::size_t got = 0; got < length;) {
+        if (begin == end && !Fill()) {
+          return false;
+        }
+        std::size_t count = std::min(end - begin, length - got);
+        std::memcpy(bytes.data() + got, buffer + begin, count);
+        begin += count;
+        got += count;
+      }
+      return true;
+    }
+
+    bool WriteAll(std::string_view data) {
+      while (!data.empty()) {
+        ssize_t written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return false;
+        }
+        data.remove_prefix(static_cast<std::size_t>(written));
+      }
+      return true;
+    }
+  };
+
+  static bool Respond(Connection &connection, int status, const std::string &out, const std::string &err) {
+    const std::string header = std::to_string(status) + " " + std::to_string(out.size()) + " " +
+                               std::to_string(err.size()) + "\n";
+    return connection.WriteAll(header) && connection.WriteAll(out) && connection.WriteAll(err);
+  }
+
+  /// Answer the next request on `connection`; false if the connection should be closed.
+  static bool ServeOne(Connection &connection, const Options &options) {
+    std::size_t length;
+    std::vector<char> text;
+    if (!connection.ReadLength(length)) {
+      return false;
+    }
+    if (length > MAX_SCRIPT) {
+      Respond(connection, 1, "", "ERROR: Script too large.\n");
+      return false;
+    }
+    if (!connection.ReadExact(length, text)) {
+      return false;
+    }
+    std::string out, err;
+    int status = Batch::RunCaptured(SourceFile(std::move(text)), options, out, err);
+    return Respond(connection, status, out, err);
+  }
+
+  // Connections passed between the poll loop and the workers.
+  class Queue {
+  private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::unique_ptr<Connection>> waiting{};    // Have a request to read
+    std::vector<std::unique_ptr<Connection>> returned{}; // Served; to be polled again
+    bool stopped = false;
+
+  public:
+    int wake[2] = {-1, -1}; // Pipe that tells the poll loop something was returned
+
+    ~Queue() {
+      for (int fd : wake) {
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+    }
+
+    void Dispatch(std::unique_ptr<Connection> connection) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiting.push_back(std::move(connection));
+      }
+      ready.notify_one();
+    }
+
+    /// The next connection to serve, or nullptr once the server stops.
+    std::unique_ptr<Connection> Take() {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [this] { return stopped || !waiting.empty(); });
+      if (stopped) {
+        return nullptr;
+      }
+      std::unique_ptr<Connection> connection = std::move(waiting.front());
+      waiting.pop_front();
+      return connection;
+    }
+
+    void Return(std::unique_ptr<Connection> connection) {
+      if (connection->HasBuffered()) {
+        Dispatch(std::move(connection)); // A pipelined request is already here
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        returned.push_back(std::move(connection));
+      }
+      const char byte = 0;
+      while (write(wake[1], &byte, 1) < 0 && errno == EINTR) {
+      }
+    }
+
+    /// Move the connections the workers gave back onto `idle`.
+    void Collect(std::vector<std::unique_ptr<Connection>> &idle) {
+      char bytes[64];
+      while (read(wake[0], bytes, sizeof(bytes)) == static_cast<ssize_t>(sizeof(bytes))) {
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::unique_ptr<Connection> &connection : returned) {
+        idle.push_back(std::move(connection));
+      }
+      returned.clear();
+    }
+
+    void Stop() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+      }
+      ready.notify_all();
+    }
+  };
+
+  static void Worker(Queue &queue, const Options &options) {
+    while (std::unique_ptr<Connection> connection = queue.Take()) {
+      if (ServeOne(*connection, options)) {
+        queue.Return(std::move(connection));
+      }
+    }
+  }
+
+  /// Accept clients and dispatch their requests until accept() fails for good.
+  static void Poll(int listener, Queue &queue) {
+    std::vector<std::unique_ptr<Connection>> idle;
+    std::vector<pollfd> fds;
+    for (;;) {
+      fds.assign({{listener, POLLIN, 0}, {queue.wake[0], POLLIN, 0}});
+      for (const std::unique_ptr<Connection> &connection : idle) {
+        fds.push_back({connection->Descriptor(), POLLIN, 0});
+      }
+      if (poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cerr << "ERROR: poll failed: " << std::strerror(errno) << std::endl;
+        return;
+      }
+
+      // Hand out every idle connection with something to read (a request, or the client closing).
+      std::size_t kept = 0;
+      for (std::size_t i = 0; i < idle.size(); ++i) {
+        if (fds[i + 2].revents != 0) {
+          queue.Dispatch(std::move(idle[i]));
+        } else {
+          idle[kept++] = std::move(idle[i]);
+        }
+      }
+      idle.resize(kept);
+      if (fds[1].revents != 0) {
+        queue.Collect(idle);
+      }
+      if (fds[0].revents != 0) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) {
+            continue;
+          }
+          std::cerr << "ERROR: accept failed: " << std::strerror(errno) << std::endl;
+          return;
+        }
+        const timeval timeout{READ_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        idle.push_back(std::make_unique<Connection>(fd));
+      }
+    }
+  }
+#endif
+
+public:
+  /// Serve requests until the process is signalled; returns non-zero if the socket cannot be set up.
+  static int Run(const Options &options) {
+#if MC_HAVE_UNIX_SOCKETS
+    const std::string &path = options.serve_socket;
+    if (path.size() >= sizeof(socket_path)) {
+      std::cout << "ERROR: Socket path '" << path << "' is too long." << std::endl;
+      return 1;
+    }
+    // Replace a socket left behind by an earlier server, but never a regular file.
+    struct stat info {};
+    if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+      unlink(path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+      std::cout << "ERROR: Unable to listen on '" << path << "': " << std::strerror(errno) << "." << std::endl;
+      if (listener >= 0) {
+        close(listener);
+      }
+      return 1;
+    }
+    Queue queue;
+    if (pipe(queue.wake) != 0 || fcntl(queue.wake[0], F_SETFL, O_NONBLOCK) != 0) {
+      std::cout << "ERROR: Unable to set up the server: " << std::strerror(errno) << "." << std::endl;
+      close(listener);
+      unlink(path.c_str());
+      return 1;
+    }
+    std::memcpy(socket_path, path.c_str(), path.size() + 1);
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+
+    std::size_t jobs = options.jobs > 0 ? static_cast<std::size_t>(options.jobs)
+                                        : std::max(1u, std::thread::hardware_concurrency());
+    std::cerr << "Serving on " << path << " with " << jobs << " workers" << std::endl;
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back(Worker, std::ref(queue), std::cref(options));
+    }
+    Poll(listener, queue);
+    queue.Stop();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    close(listener);
+    unlink(socket_path);
+    return 1; // Only reached if accept() or poll() fails for good
+#else
+    (void)options;
+    std::cout << "ERROR: --serve needs Unix domain sockets." << std::endl;
+    return 1;
+#endif
+  }
+};
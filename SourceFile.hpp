@@ -0,0 +1,124 @@
+#pragma once
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MC_HAVE_MMAP 1
+#else
+#define MC_HAVE_MMAP 0
+#endif
+
+// Read-only text of a script. Regular files are memory-mapped so tokens can
+// point straight into the mapping; anything else (pipes, in-memory scripts)
+// is copied once into an owned buffer. The text stays at the same address
+// when a SourceFile is moved, so string_views into it remain valid.
+class SourceFile {
+private:
+  const char *data = nullptr;
+  std::size_t length = 0;
+  bool mapped = false;
+  std::vector<char> buffer{};
+
+  void Adopt(std::vector<char> &&bytes) {
+    buffer = std::move(bytes);
+    data = buffer.data();
+    length = buffer.size();
+  }
+
+  void Close() {
+#if MC_HAVE_MMAP
+    if (mapped) {
+      munmap(const_cast<char *>(data), length);
+    }
+#endif
+    data = nullptr;
+    length = 0;
+    mapped = false;
+    buffer.clear();
+  }
+
+public:
+  SourceFile() = default;
+  explicit SourceFile(std::string_view text) {
+    Adopt(std::vector<char>(text.begin(), text.end()));
+  }
+  /// Take ownership of text already read into memory.
+  explicit SourceFile(std::vector<char> &&bytes) { Adopt(std::move(bytes)); }
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+  SourceFile(SourceFile &&other) noexcept { *this = std::move(other); }
+  SourceFile &operator=(SourceFile &&other) noexcept {
+    if (this != &other) {
+      Close();
+      data = std::exchange(other.data, nullptr);
+      length = std::exchange(other.length, 0);
+      mapped = std::exchange(other.mapped, false);
+      buffer = std::move(other.buffer);
+    }
+    return *this;
+  }
+  ~SourceFile() { Close(); }
+
+  /// Refer to text owned elsewhere; the caller keeps it alive.
+  static SourceFile Borrow(std::string_view text) {
+    SourceFile source;
+    source.data = text.data();
+    source.length = text.size();
+    return source;
+  }
+
+  /// Load a file, mapping it if possible; returns false if it cannot be read.
+  bool Open(const std::string &filename) {
+    Close();
+#if MC_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info {};
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+      void *addr = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        madvise(addr, static_cast<std::size_t>(info.st_size), MADV_SEQUENTIAL);
+        data = static_cast<const char *>(addr);
+        length = static_cast<std::size_t>(info.st_size);
+        mapped = true;
+        close(fd);
+        return true;
+      }
+    }
+    // Not mappable (empty file, pipe, ...): read it instead.
+    std::vector<char> bytes;
+    char chunk[1 << 16];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+      bytes.insert(bytes.end(), chunk, chunk + count);
+    }
+    close(fd);
+    if (count < 0) {
+      return false;
+    }
+    Adopt(std::move(bytes));
+    return true;
+#else
+    std::ifstream file(filename, std::ios::binary);
+    if (file.fail()) {
+      return false;
+    }
+    Adopt(std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+    return true;
+#endif
+  }
+
+  std::string_view Text() const { return {data, length}; }
+  bool IsMapped() const { return mapped; }
+};
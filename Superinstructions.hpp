@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ASTNode.hpp"
+#include "logger.hpp"
+
+// Fuses the statement shapes that make up nearly every script into single
+// nodes for the tree walker, so running one no longer visits a chain of
+// ASSIGN -> EXPRESSION -> VARIABLE/VALUE nodes that each store a result:
+//   x = <literal>;     ASSIGN_CONST
+//   x = y;             ASSIGN_SLOT
+//   print(<literal>)   the item becomes a VALUE, printed directly
+//   print(y)           the item becomes a VARIABLE, printed directly
+// Each pattern's hit count is logged. The bytecode back ends get the same
+// fusions as superinstructions while lowering (see Bytecode.hpp).
+class Superinstructions {
+private:
+  ASTArena &arena;
+  std::size_t assign_const = 0;
+  std::size_t assign_slot = 0;
+  std::size_t print_const = 0;
+  std::size_t print_slot = 0;
+
+  explicit Superinstructions(ASTArena &arena)
+      : arena(arena) {}
+
+  // What an expression evaluates to, if it is a literal (or empty term) or a single variable.
+  enum class Term { CONSTANT, SLOT, OTHER };
+  Term Classify(NodeId id, double &value, std::size_t &slot) const {
+    const ASTNode *node = &arena[id];
+    if (node->GetType() == ASTNode::EXPRESSION) {
+      node = &arena[arena.GetChild(*node, 0)];
+    }
+    switch (node->GetType()) {
+      case ASTNode::VALUE:
+      case ASTNode::EMPTY: // Leaves the expression at its default of 0
+        value = node->GetValue();
+        return Term::CONSTANT;
+      case ASTNode::VARIABLE:
+        slot = node->GetId();
+        return Term::SLOT;
+      default:
+        return Term::OTHER;
+    }
+  }
+
+  void FuseStatement(NodeId id) {
+    const ASTNode &node = arena[id];
+    auto children = arena.GetChildren(node);
+    double value = 0.0;
+    std::size_t slot = 0;
+    switch (node.GetType()) {
+      case ASTNode::EMPTY:
+      case ASTNode::STATEMENT_BLOCK:
+        for (NodeId statement : children) {
+          FuseStatement(statement);
+        }
+        break;
+      case ASTNode::ASSIGN: {
+        const std::size_t target = arena[children[0]].GetId();
+        switch (Classify(children[1], value, slot)) {
+          case Term::CONSTANT:
+            arena.ReplaceWithAssignConst(id, target, value);
+            ++assign_const;
+            break;
+          case Term::SLOT:
+            if (slot <= UINT32_MAX) {
+              arena.ReplaceWithAssignSlot(id, target, static_cast<std::uint32_t>(slot));
+              ++assign_slot;
+            }
+            break;
+          case Term::OTHER:
+            break;
+        }
+        break;
+      }
+      case ASTNode::PRINT:
+        for (NodeId item : children) {
+          switch (Classify(item, value, slot)) {
+            case Term::CONSTANT:
+              arena.ReplaceWithValue(item, value);
+              ++print_const;
+              break;
+            case Term::SLOT:
+              arena.ReplaceWithVariable(item, slot);
+              ++print_slot;
+              break;
+            case Term::OTHER:
+              break;
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+public:
+  /// Rewrite the program under `root` for the tree walker.
+  static void Run(ASTArena &arena, NodeId root) {
+    Superinstructions fuser(arena);
+    fuser.FuseStatement(root);
+    LOG(INFO) << "Superinstructions: assign_const " << fuser.assign_const << ", assign_slot " << fuser.assign_slot
+              << ", print_const " << fuser.print_const << ", print_slot " << fuser.print_slot;
+  }
+};
@@ -1,92 +1,98 @@
 #pragma once
 
-#include <algorithm>
-#include <assert.h>
+#include <cstdint>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
-#include "VarTable.hpp"
+#include "Allocation.hpp"
+#include "Interner.hpp"
 #include "error.hpp"
 
+// Resolves names at parse time and holds variable values at run time.
+// Open declarations form one stack whose positions are their slots in a flat
+// frame; leaving a scope hands its slots to the next sibling scope.
 class SymbolTable {
 private:
-  std::vector<VarTable> scopes{};
-  std::vector<std::shared_ptr<Var>> variables{};
+  static constexpr std::uint32_t NONE = UINT32_MAX;
 
-  std::vector<VarTable>::const_reverse_iterator GetScope(std::string varName) const {
-    return std::find_if(
-        scopes.rbegin(),
-        scopes.rend(),
-        [&varName](auto &scope) { return scope.HasVar(varName); });
-  }
+  struct Declaration {
+    Symbol symbol;
+    std::uint32_t shadowed; // Declaration of the same name this one hides, or NONE
+  };
+
+  std::vector<Declaration> declarations{}; // Open declarations, indexed by slot
+  std::vector<std::size_t> scope_base{};   // First slot owned by each open scope
+  std::vector<std::uint32_t> innermost{};  // By Symbol: slot of its visible declaration, or NONE
+  std::vector<double> frame{};
 
-  bool IsValidScope(std::vector<VarTable>::const_reverse_iterator scope) const {
-    return scope != scopes.rend();
+  std::uint32_t Find(Symbol symbol) const {
+    return symbol < innermost.size() ? innermost[symbol] : NONE;
   }
 
 public:
   void PushScope() {
-    scopes.push_back(VarTable{});
+    MemoryTag tag(Structure::SYMBOLS);
+    scope_base.push_back(declarations.size());
   }
 
   void PopScope() {
-    scopes.pop_back();
+    for (std::size_t slot = declarations.size(); slot > scope_base.back(); --slot) {
+      const Declaration &declaration = declarations[slot - 1];
+      innermost[declaration.symbol] = declaration.shadowed;
+    }
+    declarations.resize(scope_base.back());
+    scope_base.pop_back();
   }
 
-  bool HasVar(std::string name) const {
-    return IsValidScope(GetScope(name));
+  bool HasVar(Symbol symbol) const {
+    return Find(symbol) != NONE;
   }
 
-  size_t AddVar(std::string name, size_t lineNumber) {
-    if (scopes.empty()) {
+  /// `name` is only used to report errors.
+  size_t AddVar(Symbol symbol, std::string_view name, size_t lineNumber) {
+    if (scope_base.empty()) {
       throw Err(lineNumber, "Scope not initialized");
     }
-
-    std::size_t id = variables.size();
-    variables.push_back(scopes.back().AddVar(id, lineNumber, name));
-    return id;
-  }
-
-  /// Set/Get by id
-  double GetValue(int lineNumber, size_t id) const {
-    if (id >= variables.size()) {
-      throw Err(lineNumber, "Getting variable that does not exist");
+    const std::uint32_t shadowed = Find(symbol);
+    if (shadowed != NONE && shadowed >= scope_base.back()) {
+      throw Err(lineNumber, "Variable", name, " already exists");
     }
-    return variables.at(id)->value;
-  }
 
-  void SetValue(int lineNumber, size_t id, double value) {
-    if (id >= variables.size()) {
-      throw Err(lineNumber, "Setting variable that does not exist");
+    MemoryTag tag(Structure::SYMBOLS);
+    const std::size_t slot = declarations.size();
+    declarations.push_back({symbol, shadowed});
+    if (innermost.size() <= symbol) {
+      innermost.resize(symbol + 1, NONE);
     }
-    variables.at(id)->value = value;
-  }
-
-  /// Set/Get by name
-  double GetValue(int lineNumber, std::string name) const {
-    auto scope = GetScope(name);
-    if (!IsValidScope(scope)) {
-      throw Err(lineNumber, "Variable " + name + "does not exist");
+    innermost[symbol] = static_cast<std::uint32_t>(slot);
+    if (frame.size() <= slot) {
+      frame.resize(slot + 1);
     }
+    return slot;
+  }
 
-    return scope->GetVar(lineNumber, name).value;
+  /// Run-time access by slot; slots come from AddVar/GetIdBySymbol so are always in range.
+  double GetValue(size_t slot) const { return frame[slot]; }
+  void SetValue(size_t slot, double value) { frame[slot] = value; }
+  double *GetFrame() { return frame.data(); }
+  std::size_t GetFrameSize() const { return frame.size(); }
+  /// Size the frame for a program resolved earlier (see ScriptCache).
+  void SetFrameSize(std::size_t size) {
+    MemoryTag tag(Structure::SYMBOLS);
+    frame.assign(size, 0.0);
   }
 
-  std::size_t GetIdByName(int lineNumber, std::string name) {
-    auto scope = GetScope(name);
-    if (!IsValidScope(scope)) {
-      throw Err(lineNumber, "Variable " + name + "does not exist");
+  std::size_t GetIdBySymbol(int lineNumber, Symbol symbol, std::string_view name) const {
+    const std::uint32_t slot = Find(symbol);
+    if (slot == NONE) {
+      throw Err(lineNumber, "Variable ", name, "does not exist");
     }
 
-    return scope->GetVar(lineNumber, name).id;
-  }
-
-  void SetValue(int lineNumber, std::string name, double value) {
-    scopes.back().SetVar(lineNumber, name, value);
+    return slot;
   }
 
   std::size_t GetScopeCount() {
-    return scopes.size();
+    return scope_base.size();
   }
 };
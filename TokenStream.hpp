@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <thread>
+
+#include "Allocation.hpp"
+#include "Scanner.hpp"
+#include "lexer.hpp"
+
+// Incremental token source for the parser. Tokens are pulled from the lexer
+// on demand into a two-token lookahead window, so memory does not grow with
+// the length of the input. In threaded mode a producer thread lexes ahead
+// into a bounded single-producer/single-consumer ring buffer. A stream can
+// also replay tokens that were already lexed into a vector.
+class TokenStream {
+private:
+  static constexpr std::size_t LOOKAHEAD = 2;
+  static constexpr std::size_t QUEUE_SIZE = 4096; // Must be a power of two
+
+  std::string_view text;
+  Scanner scanner{};
+  std::array<emplex::Token, LOOKAHEAD> window{}; // window[0] is the current token
+  std::size_t buffered = 0;
+  std::size_t last_line = 1; // Line of the most recently used token
+  bool finished = false;     // Lexer has reached the end of the input
+
+  std::span<const emplex::Token> pre_lexed{}; // Replayed instead of lexing, if set
+  std::size_t pre_lexed_pos = 0;
+  bool use_pre_lexed = false;
+
+  // -- Threaded mode --
+  std::unique_ptr<emplex::Token[]> queue{};
+  alignas(64) std::atomic<std::size_t> queue_head{0}; // Next slot the parser reads
+  alignas(64) std::atomic<std::size_t> queue_tail{0}; // Next slot the lexer writes
+  std::atomic<bool> stop{false};
+  std::thread producer{};
+
+  // Next significant token straight from the lexer (EOF has id 0).
+  emplex::Token Lex() {
+    if (use_pre_lexed) {
+      if (pre_lexed_pos < pre_lexed.size()) {
+        return pre_lexed[pre_lexed_pos++];
+      }
+      return emplex::Token{0, "", last_line};
+    }
+    return scanner.NextSignificantToken(text);
+  }
+
+  void ProducerLoop() {
+    std::size_t tail = 0;
+    for (;;) {
+      emplex::Token token = Lex();
+      while (tail - queue_head.load(std::memory_order_acquire) == QUEUE_SIZE) {
+        if (stop.load(std::memory_order_relaxed)) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+      queue[tail & (QUEUE_SIZE - 1)] = token;
+      queue_tail.store(++tail, std::memory_order_release);
+      if (!token || stop.load(std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+
+  emplex::Token Pop() {
+    const std::size_t head = queue_head.load(std::memory_order_relaxed);
+    while (queue_tail.load(std::memory_order_acquire) == head) {
+      std::this_thread::yield();
+    }
+    emplex::Token token = queue[head & (QUEUE_SIZE - 1)];
+    queue_head.store(head + 1, std::memory_order_release);
+    return token;
+  }
+
+  // Make sure at least `count` tokens are in the window; false if the input ends first.
+  bool Fill(std::size_t count) {
+    while (buffered < count && !finished) {
+      emplex::Token token = producer.joinable() ? Pop() : Lex();
+      if (!token) {
+        finished = true;
+        break;
+      }
+      window[buffered++] = token;
+    }
+    return buffered >= count;
+  }
+
+public:
+  /// ID tokens are interned into `interner`; in threaded mode only the lexer thread touches it.
+  TokenStream(std::string_view text, Interner &interner, bool threaded = false)
+      : text(text) {
+    scanner.SetInterner(&interner);
+    if (threaded) {
+      MemoryTag tag(Structure::TOKENS);
+      queue = std::make_unique<emplex::Token[]>(QUEUE_SIZE);
+      producer = std::thread([this] { ProducerLoop(); });
+    }
+  }
+  /// Replay tokens from Lexer::Tokenize; they must outlive the stream.
+  explicit TokenStream(std::span<const emplex::Token> tokens)
+      : pre_lexed(tokens), use_pre_lexed(true) {}
+  TokenStream(const TokenStream &) = delete;
+  TokenStream &operator=(const TokenStream &) = delete;
+  ~TokenStream() {
+    if (producer.joinable()) {
+      stop.store(true, std::memory_order_relaxed);
+      producer.join();
+    }
+  }
+
+  /// Start replaying `tokens` over again from index `first` (see Compiler::reparse).
+  void Replay(std::span<const emplex::Token> tokens, std::size_t first) {
+    pre_lexed = tokens;
+    pre_lexed_pos = first;
+    use_pre_lexed = true;
+    buffered = 0;
+    finished = false;
+  }
+
+  /// Index of the current token among the replayed tokens (replaying streams only).
+  std::size_t Position() const { return pre_lexed_pos - buffered; }
+
+  bool AtEnd() { return !Fill(1); }
+
+  /// Token `ahead` positions past the current one, or nullptr past the end of input.
+  const emplex::Token *Peek(std::size_t ahead = 0) {
+    return Fill(ahead + 1) ? &window[ahead] : nullptr;
+  }
+
+  /// Consume the current token (an EOF token once the input is exhausted).
+  emplex::Token Next() {
+    if (!Fill(1)) {
+      return emplex::Token{0, "", last_line};
+    }
+    emplex::Token token = window[0];
+    for (std::size_t i = 1; i < buffered; ++i) {
+      window[i - 1] = window[i];
+    }
+    --buffered;
+    last_line = token.line_id;
+    return token;
+  }
+
+  std::size_t GetLastLine() const { return last_line; }
+};
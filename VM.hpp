@@ -0,0 +1,99 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+#include "Bytecode.hpp"
+#include "SymbolTable.hpp"
+#include "output.hpp"
+
+// Use GCC/Clang "labels as values" for threaded dispatch when available.
+#ifndef MC_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define MC_COMPUTED_GOTO 1
+#else
+#define MC_COMPUTED_GOTO 0
+#endif
+#endif
+
+class VM {
+public:
+  static void Run(const Bytecode &program, SymbolTable &symbols) {
+    const Instruction *ip = program.GetCode().data();
+    const double *constants = program.GetConstants().data();
+    std::vector<double> stack(program.GetMaxStack() + 1);
+    double *sp = stack.data(); // Points one past the top of the stack
+    double *frame = symbols.GetFrame();
+    OutputBuffer &out = output; // Look up this thread's buffer once
+
+#if MC_COMPUTED_GOTO
+    // Must stay in the same order as the Op enum.
+    static constexpr void *labels[] = {&&op_PUSH_CONST, &&op_LOAD, &&op_STORE,
+                                       &&op_PRINT, &&op_PRINT_END, &&op_HALT,
+                                       &&op_STORE_CONST, &&op_MOVE, &&op_PRINT_CONST, &&op_PRINT_SLOT};
+#define VM_CASE(name) op_##name:
+#define VM_NEXT()                                     \
+  do {                                                \
+    ++ip;                                             \
+    goto *labels[static_cast<std::size_t>(ip->op)];   \
+  } while (0)
+    goto *labels[static_cast<std::size_t>(ip->op)];
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_NEXT() \
+  {               \
+    ++ip;         \
+    continue;     \
+  }
+    for (;;) {
+      switch (ip->op) {
+#endif
+
+    VM_CASE(PUSH_CONST) {
+      *sp++ = constants[ip->arg];
+      VM_NEXT();
+    }
+    VM_CASE(LOAD) {
+      *sp++ = frame[ip->arg];
+      VM_NEXT();
+    }
+    VM_CASE(STORE) {
+      frame[ip->arg] = *--sp;
+      VM_NEXT();
+    }
+    VM_CASE(PRINT) {
+      out.Write(*--sp);
+      VM_NEXT();
+    }
+    VM_CASE(PRINT_END) {
+      out.EndLine();
+      VM_NEXT();
+    }
+    VM_CASE(HALT) {
+      return;
+    }
+    VM_CASE(STORE_CONST) {
+      frame[ip->arg] = constants[ip->arg2];
+      VM_NEXT();
+    }
+    VM_CASE(MOVE) {
+      frame[ip->arg] = frame[ip->arg2];
+      VM_NEXT();
+    }
+    VM_CASE(PRINT_CONST) {
+      out.Write(constants[ip->arg]);
+      VM_NEXT();
+    }
+    VM_CASE(PRINT_SLOT) {
+      out.Write(frame[ip->arg]);
+      VM_NEXT();
+    }
+
+#if !MC_COMPUTED_GOTO
+      }
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+  }
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Interner.hpp"
+#include "SourceFile.hpp"
+#include "compiler.hpp"
+#include "error.hpp"
+#include "Scanner.hpp"
+#include "lexer.hpp"
+#include "options.hpp"
+#include "output.hpp"
+
+// Re-runs a script every time it is saved (--watch). The text, its tokens and
+// the parsed program stay in memory between runs. When the file changes, only
+// the bytes between the unchanged head and tail are lexed again: from one token
+// before the first changed byte, until a new token starts where an old one did
+// in the unchanged tail, from which point the old tokens are reused. Then
+// Compiler::reparse parses just the statements around the edit, within the
+// innermost block it left intact. A full parse is the fallback when the block
+// structure changes, after an error, or once replaced nodes pile up.
+class Watcher {
+private:
+  static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+  static constexpr std::size_t MAX_GROWTH = 2; // Arena size, relative to a fresh parse, that forces a full parse
+  static constexpr std::size_t BLOCK = 4096;   // Bytes compared or searched at a time
+
+  Options options;
+  std::vector<char> text{};            // Current contents of the script, with room to grow in place
+  Interner names{};                    // Shared by every lexing pass, so symbols stay stable
+  std::vector<emplex::Token> tokens{}; // Views into `text`
+  std::optional<Compiler> program{};   // Parsed but not optimized; empty after a parse error
+  std::size_t fresh_size = 0;          // Node count after the last full parse
+
+  explicit Watcher(const Options &options)
+      : options(options) {}
+
+  std::string_view Text() const { return {text.data(), text.size()}; }
+
+  /// Read the script into memory of its own; a mapping would change under us as the file is rewritten.
+  static bool Read(const std::string &filename, std::vector<char> &bytes) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+  }
+
+  /// What changes when the file is saved (polled, so it works on any file system).
+  static std::pair<std::filesystem::file_time_type, std::uintmax_t> Stamp(const std::string &filename) {
+    std::error_code error;
+    return {std::filesystem::last_write_time(filename, error), std::filesystem::file_size(filename, error)};
+  }
+
+  /// Length of the longest common prefix of `a` and `b`.
+  static std::size_t CommonHead(std::string_view a, std::string_view b) {
+    const std::size_t limit = std::min(a.size(), b.size());
+    std::size_t length = 0;
+    while (length + BLOCK <= limit && std::memcmp(a.data() + length, b.data() + length, BLOCK) == 0) {
+      length += BLOCK;
+    }
+    while (length < limit && a[length] == b[length]) {
+      ++length;
+    }
+    return length;
+  }
+
+  /// Length of the longest common suffix of `a` and `b`, at most `limit`.
+  static std::size_t CommonTail(std::string_view a, std::string_view b, std::size_t limit) {
+    const char *a_end = a.data() + a.size();
+    const char *b_end = b.data() + b.size();
+    std::size_t length = 0;
+    while (length + BLOCK <= limit && std::memcmp(a_end - length - BLOCK, b_end - length - BLOCK, BLOCK) == 0) {
+      length += BLOCK;
+    }
+    while (length < limit && a_end[-1 - static_cast<std::ptrdiff_t>(length)] == b_end[-1 - static_cast<std::ptrdiff_t>(length)]) {
+      ++length;
+    }
+    return length;
+  }
+
+  /// Offset of the last '"' in `text` before `end`, or npos.
+  static std::size_t LastQuote(std::string_view text, std::size_t end) {
+    while (end > 0) {
+      const std::size_t begin = end > BLOCK ? end - BLOCK : 0;
+      const char *last = nullptr;
+      for (const char *at = text.data() + begin;
+           (at = static_cast<const char *>(std::memchr(at, '"', static_cast<std::size_t>(text.data() + end - at)))); ++at) {
+        last = at;
+      }
+      if (last) {
+        return static_cast<std::size_t>(last - text.data());
+      }
+      end = begin;
+    }
+    return std::string_view::npos;
+  }
+
+  // Make room for `size` bytes of text, moving the tokens along if the text moves.
+  void Reserve(std::size_t size) {
+    if (size <= text.capacity()) {
+      return;
+    }
+    std::vector<char> grown;
+    grown.reserve(size + size / 4);
+    grown.assign(text.begin(), text.end());
+    for (emplex::Token &token : tokens) {
+      token.lexeme = {grown.data() + (token.lexeme.data() - text.data()), token.lexeme.size()};
+    }
+    text.swap(grown);
+  }
+
+  // Turn the text into `next`, lexing again only around the change. `edit` says which tokens
+  // were replaced, and `replaced` receives the old ones.
+  void Relex(std::string_view next, TokenEdit &edit, std::vector<emplex::Token> &replaced) {
+    Reserve(next.size());
+    const std::string_view old = Text();
+    const std::size_t head = CommonHead(old, next);
+    const std::size_t tail = CommonTail(old, next, std::min(old.size(), next.size()) - head);
+    // Offsets of the old tokens stay readable after the text is edited in place, as it does not move.
+    auto offset = [this](const emplex::Token &token) { return static_cast<std::size_t>(token.lexeme.data() - text.data()); };
+
+    // The first token reaching a changed byte must be lexed again, and so must the one before
+    // it, since where a token ends depends on the byte after it. A string (or a lone quote
+    // that may become one) scans ahead to the next quote, so the token holding the last quote
+    // before the change is lexed again too.
+    auto ends_before = [&](std::size_t at) {
+      return static_cast<std::size_t>(
+          std::partition_point(tokens.begin(), tokens.end(),
+                               [&](const emplex::Token &token) { return offset(token) + token.lexeme.size() <= at; }) -
+          tokens.begin());
+    };
+    const std::size_t reached = head > 0 ? ends_before(head - 1) : 0;
+    edit.first = reached > 0 ? reached - 1 : 0;
+    if (const std::size_t quote = LastQuote(old, head); quote != std::string_view::npos) {
+      const std::size_t holder = ends_before(quote);
+      if (holder < edit.first && offset(tokens[holder]) <= quote) {
+        edit.first = holder;
+      }
+    }
+    Scanner scanner;
+    scanner.SetInterner(&names);
+    if (reached > 0) {
+      scanner.Seek(offset(tokens[edit.first]), tokens[edit.first].line_id);
+    }
+
+    const std::size_t old_size = old.size();
+    const std::size_t stable = next.size() - tail; // Bytes from here on match the old text's tail
+    if (next.size() != old_size) {
+      text.resize(std::max(old_size, next.size())); // Within the reserved capacity, so nothing moves
+      std::memmove(text.data() + stable, text.data() + old_size - tail, tail);
+      text.resize(next.size());
+    }
+    std::memcpy(text.data() + head, next.data() + head, stable - head);
+
+    std::vector<emplex::Token> relexed;
+    std::size_t old_index = edit.first;
+    edit.old_end = tokens.size();
+    while (emplex::Token token = scanner.NextSignificantToken(Text())) {
+      const std::size_t at = offset(token);
+      if (at >= stable) {
+        // Once a token starts where an old one did, lexing carries on exactly as it did before.
+        const std::size_t old_at = at + old_size - next.size();
+        while (old_index < tokens.size() && offset(tokens[old_index]) < old_at) {
+          ++old_index;
+        }
+        if (old_index < tokens.size() && offset(tokens[old_index]) == old_at) {
+          edit.old_end = old_index;
+          edit.line_shift = static_cast<std::ptrdiff_t>(token.line_id) - static_cast<std::ptrdiff_t>(tokens[old_index].line_id);
+          break;
+        }
+      }
+      relexed.push_back(token);
+    }
+    edit.new_end = edit.first + relexed.size();
+
+    const auto first = tokens.begin() + static_cast<std::ptrdiff_t>(edit.first);
+    const auto old_end = tokens.begin() + static_cast<std::ptrdiff_t>(edit.old_end);
+    replaced.assign(first, old_end);
+    const std::ptrdiff_t grow = static_cast<std::ptrdiff_t>(next.size()) - static_cast<std::ptrdiff_t>(old_size);
+    if (grow != 0 || edit.line_shift != 0) {
+      for (auto token = old_end; token != tokens.end(); ++token) {
+        token->lexeme = {token->lexeme.data() + grow, token->lexeme.size()};
+        token->line_id = static_cast<std::size_t>(static_cast<std::ptrdiff_t>(token->line_id) + edit.line_shift);
+      }
+    }
+    if (relexed.size() == replaced.size()) {
+      std::copy(relexed.begin(), relexed.end(), first);
+    } else {
+      tokens.insert(tokens.erase(first, old_end), relexed.begin(), relexed.end());
+    }
+  }
+
+  /// Bring the tokens and program up to date with `next` and run it.
+  void Update(const std::vector<char> &next) {
+    const auto start = std::chrono::steady_clock::now();
+    TokenEdit edit;
+    std::vector<emplex::Token> replaced;
+    Relex(std::string_view(next.data(), next.size()), edit, replaced);
+
+    std::size_t reparsed = 0;
+    bool incremental = false;
+    try {
+      incremental = program && program->GetNodeCount() <= MAX_GROWTH * fresh_size &&
+                    program->reparse(tokens, replaced, edit, reparsed);
+      if (!incremental) {
+        program.reset();
+        program.emplace(SourceFile::Borrow(Text()), std::span<const emplex::Token>(tokens), options);
+        program->parse();
+        fresh_size = program->GetNodeCount();
+      }
+    } catch (const Err &e) {
+      program.reset();
+      std::cerr << e.what() << std::endl;
+      return;
+    }
+
+    char timing[32];
+    std::snprintf(timing, sizeof(timing), "%.3f ms",
+                  std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    std::cerr << "Watch: " << options.filename << ": relexed " << edit.new_end - edit.first << " of " << tokens.size()
+              << " tokens, "
+              << (incremental ? "reparsed " + std::to_string(reparsed) + " statements" : std::string("full parse"))
+              << " in " << timing << std::endl;
+
+    try {
+      Compiler run(SourceFile::Borrow(Text()), std::span<const emplex::Token>{}, options);
+      run.load(*program);
+      run.optimize();
+      run.execute();
+      output.Flush();
+    } catch (const Err &e) {
+      output.Flush();
+      std::cerr << e.what() << std::endl;
+    }
+  }
+
+public:
+  /// Run `options.filename`, then again after every change to it, until interrupted.
+  static int Run(const Options &options) {
+    std::vector<char> next;
+    if (!Read(options.filename, next)) {
+      std::cout << "ERROR: Unable to open file '" << options.filename << "'." << std::endl;
+      return 1;
+    }
+    Watcher watcher(options);
+    auto stamp = Stamp(options.filename);
+    watcher.Update(next);
+    for (;;) {
+      std::this_thread::sleep_for(POLL_INTERVAL);
+      const auto now = Stamp(options.filename);
+      if (now == stamp || !Read(options.filename, next)) {
+        continue;
+      }
+      stamp = now;
+      if (std::string_view(next.data(), next.size()) != watcher.Text()) {
+        watcher.Update(next);
+      }
+    }
+  }
+};
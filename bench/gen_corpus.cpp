@@ -0,0 +1,143 @@
+// Generates the MacroCalc benchmark corpus.
+//
+//   gen_corpus <output_dir> [scale]
+//
+// Output is fully determined by `scale` (default 1) so results can be
+// compared across builds. Workloads only use statements the interpreter
+// supports: var, assignment, print and { } scopes.
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+
+// Small fixed PRNG; std:: distributions differ between standard libraries.
+class Rng {
+private:
+  std::uint64_t state;
+
+public:
+  explicit Rng(std::uint64_t seed) : state(seed) {}
+  std::uint64_t Next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+  std::size_t Below(std::size_t bound) { return static_cast<std::size_t>(Next() % bound); }
+};
+
+// Long runs of declarations and copies between already declared variables.
+void StraightLine(std::ostream &out, std::size_t scale) {
+  Rng rng(1);
+  const std::size_t vars = 1000;
+  for (std::size_t i = 0; i < vars; ++i) {
+    out << "var v" << i << " = " << i << ";\n";
+  }
+  for (std::size_t i = 0; i < 200000 * scale; ++i) {
+    out << "v" << rng.Below(vars) << " = v" << rng.Below(vars) << ";\n";
+  }
+  out << "print(v0, v1, v2);\n";
+}
+
+// Many sibling towers of nested scopes, each declaring and reading locals.
+void DeepScopes(std::ostream &out, std::size_t scale) {
+  Rng rng(2);
+  const std::size_t depth = 100;
+  out << "var total = 0;\n";
+  for (std::size_t tower = 0; tower < 20 * scale; ++tower) {
+    for (std::size_t d = 0; d < depth; ++d) {
+      out << std::string(d % 40, ' ') << "{ var d" << d << " = ";
+      if (d == 0) {
+        out << "total;\n";
+      } else {
+        out << "d" << d - 1 << ";\n";
+      }
+    }
+    for (std::size_t i = 0; i < 500; ++i) {
+      out << "d" << rng.Below(depth) << " = d" << rng.Below(depth) << ";\n";
+    }
+    out << "total = d" << rng.Below(depth) << ";\n";
+    out << std::string(depth, '}') << "\n";
+  }
+  out << "print(total);\n";
+}
+
+// Print-dominated output, one value per line.
+void PrintHeavy(std::ostream &out, std::size_t scale) {
+  Rng rng(3);
+  out << "var a = 1;\nvar b = 2.5;\nvar c = 1000000;\n";
+  const char *names[] = {"a", "b", "c"};
+  for (std::size_t i = 0; i < 100000 * scale; ++i) {
+    if (i % 2) {
+      out << "print(" << names[rng.Below(3)] << ");\n";
+    } else {
+      out << "print(" << rng.Below(100000) << "." << rng.Below(100) << ");\n";
+    }
+  }
+}
+
+// Very wide statements: prints with hundreds of operands.
+void WidePrint(std::ostream &out, std::size_t scale) {
+  Rng rng(4);
+  const std::size_t vars = 64;
+  for (std::size_t i = 0; i < vars; ++i) {
+    out << "var w" << i << " = " << i * 3 << ";\n";
+  }
+  for (std::size_t line = 0; line < 500 * scale; ++line) {
+    out << "print(";
+    for (std::size_t i = 0; i < 256; ++i) {
+      out << (i ? ", " : "") << "w" << rng.Below(vars);
+    }
+    out << ");\n";
+  }
+}
+
+// Thousands of distinct long identifiers, comments and blank lines.
+void ManyNames(std::ostream &out, std::size_t scale) {
+  Rng rng(5);
+  const std::size_t vars = 20000 * scale;
+  for (std::size_t i = 0; i < vars; ++i) {
+    out << "var identifier_number_" << i << "_with_a_long_name = " << i << ";  // declare\n";
+    if (i % 16 == 0) {
+      out << "\n// ---- section " << i / 16 << " ----\n\n";
+    }
+  }
+  for (std::size_t i = 0; i < 100000 * scale; ++i) {
+    out << "identifier_number_" << rng.Below(vars) << "_with_a_long_name = identifier_number_"
+        << rng.Below(vars) << "_with_a_long_name;\n";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cout << "Format: " << argv[0] << " [output_dir] [scale]" << std::endl;
+    return 1;
+  }
+  const std::string dir = argv[1];
+  const std::size_t scale = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+  if (scale == 0) {
+    std::cout << "ERROR: scale must be positive." << std::endl;
+    return 1;
+  }
+
+  const std::pair<const char *, std::function<void(std::ostream &, std::size_t)>> workloads[] = {
+      {"straight_line", StraightLine},
+      {"deep_scopes", DeepScopes},
+      {"print_heavy", PrintHeavy},
+      {"wide_print", WidePrint},
+      {"many_names", ManyNames},
+  };
+  for (const auto &[name, generate] : workloads) {
+    const std::string path = dir + "/" + name + ".Mc";
+    std::ofstream out(path);
+    if (!out) {
+      std::cout << "ERROR: Unable to write '" << path << "'." << std::endl;
+      return 1;
+    }
+    generate(out, scale);
+  }
+  return 0;
+}
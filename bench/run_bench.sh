@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Usage: ./run_bench.sh [runs] [scale]
+# Generates the corpus (if needed) and benchmarks every workload on both
+# engines, collecting one CSV in ../bench_output.txt.
+
+runs=${1:-5}
+scale=${2:-1}
+out_file="../bench_output.txt"
+
+if [ ! -x "../Project2" ] || [ ! -x "./gen_corpus" ]; then
+    echo "Build ../Project2 and ./gen_corpus first (make bench)."
+    exit 1
+fi
+
+# Regenerate the corpus when the scale changes.
+if [ ! -f "corpus/.scale" ] || [ "$(cat corpus/.scale)" != "$scale" ]; then
+    echo "Generating corpus (scale $scale)..."
+    mkdir -p corpus
+    ./gen_corpus corpus "$scale" || exit 1
+    echo "$scale" > corpus/.scale
+fi
+
+fail_count=0
+echo "workload,engine,phase,min_ms,median_ms,p99_ms,unit,items,items_per_sec,allocs_per_run,alloc_bytes_per_run,mb_per_sec" > "$out_file"
+for code_file in corpus/*.Mc; do
+    workload=$(basename "$code_file" .Mc)
+    for engine in tree vm; do
+        flags=""
+        [ "$engine" == "vm" ] && flags="--vm"
+        if ! ../Project2 "$code_file" $flags --bench="$runs" --bench-format=csv > current.csv; then
+            echo "Benchmark $workload ($engine) ... Failed."
+            ((fail_count++))
+            continue
+        fi
+        tail -n +2 current.csv | sed "s/^/$workload,$engine,/" >> "$out_file"
+        median=$(awk -F, '$1 == "execute" { print $3 }' current.csv)
+        echo "Benchmark $workload ($engine) ... execute median ${median} ms"
+    done
+done
+rm -f current.csv
+
+exit $fail_count
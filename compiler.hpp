@@ -2,9 +2,12 @@
 #pragma once
 
 #include <assert.h>
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -12,18 +15,53 @@
 // Below are some suggestions on how you might want to divide up your project.
 // You may delete this and divide it up however you like.
 #include "ASTNode.hpp"
+#include "Bytecode.hpp"
+#include "Governor.hpp"
+#include "JIT.hpp"
+#include "Lanes.hpp"
+#include "Optimizer.hpp"
+#include "ParallelLexer.hpp"
+#include "Profiler.hpp"
+#include "SourceFile.hpp"
+#include "Superinstructions.hpp"
+#include "ScriptCache.hpp"
 #include "SymbolTable.hpp"
+#include "TokenStream.hpp"
+#include "VM.hpp"
 #include "lexer.hpp"
 #include "logger.hpp"
+#include "options.hpp"
 
 using namespace emplex;
+
+// Tokens [first, old_end) of a program were replaced by [first, new_end) (--watch; see Watch.hpp).
+struct TokenEdit {
+  std::size_t first = 0;
+  std::size_t old_end = 0;
+  std::size_t new_end = 0;
+  std::ptrdiff_t line_shift = 0; // Lines moved by the tokens from old_end on
+};
+
 class Compiler {
 private:
-  emplex::Lexer lexer{}; // Build the lexer object
-  std::vector<emplex::Token> tokens;
-  std::size_t current_token;
+  SourceFile source; // Token lexemes are views into this text
+  Options options;
+  Interner names;                     // Identifier symbols shared by the lexer and symbol table
+  std::vector<emplex::Token> lexed{}; // Whole input, when lexed up front by --lex-jobs
+  TokenStream tokens;                 // Lexed on demand as the parser advances (or replays `lexed`)
   SymbolTable table;
-  std::shared_ptr<ASTNode> root = std::make_shared<ASTNode>(ASTNode(ASTNode::Type::STATEMENT_BLOCK));
+  ASTArena arena;
+  std::optional<Bytecode> program; // Lowered form, built on demand for the VM
+  std::optional<JIT> native;       // Machine code for --jit; empty if it fell back to the VM
+  NodeId root = arena.Add(ASTNode::Type::STATEMENT_BLOCK);
+  // Child ids of the nodes currently being parsed; each open node owns the tail
+  // of this stack until it hands its children to the arena.
+  std::vector<NodeId, TaggedAllocator<NodeId, Structure::AST>> pending_children;
+  // Token index each statement started at, by NodeId; recorded for --watch only.
+  static constexpr std::uint32_t NO_START = UINT32_MAX;
+  std::vector<std::uint32_t> statement_start{};
+  // Top-level declaration of each --bind variable, by binding (NO_BIND_POINT if not declared).
+  std::vector<NodeId> bind_points = std::vector<NodeId>(options.bindings.size(), Lanes::NO_BIND_POINT);
 
   // == HELPER ==
   std::string TokenName(int id) const {
@@ -34,11 +72,11 @@ private:
   }
 
   emplex::Token GetCurrent() {
-    if (current_token < tokens.size()) {
-      return tokens[current_token];
+    if (const emplex::Token *token = tokens.Peek()) {
+      return *token;
     }
 
-    throw Err(tokens[current_token - 1].line_id, "Unexpected end of file"); // TODO Fix line number
+    throw Err(tokens.GetLastLine(), "Unexpected end of file");
     return emplex::Token{};
   }
 
@@ -55,7 +93,7 @@ private:
     return GetCurrent();
   }
 
-  emplex::Token UseToken() { return tokens[current_token++]; }
+  emplex::Token UseToken() { return tokens.Next(); }
 
   emplex::Token UseToken(int required_id, std::string err_message = "") {
     if (GetCurrent() != required_id) {
@@ -72,30 +110,74 @@ private:
 
   bool UseTokenIf(int test_id) {
     if (GetCurrent() == test_id) {
-      current_token++;
+      tokens.Next();
       return true;
     }
     return false;
   }
 
   bool UseNextTokenIf(int test_id) {
-    if (current_token + 1 < tokens.size() && tokens[current_token + 1] == test_id) {
-      current_token++;
+    const emplex::Token *next = tokens.Peek(1);
+    if (next && *next == test_id) {
+      tokens.Next();
       return true;
     }
     return false;
   }
 
   void MoveNext() {
-    ++current_token;
+    tokens.Next();
+  }
+
+  void RecordStart(NodeId statement, std::size_t first) {
+    if (!options.watch) {
+      return;
+    }
+    if (statement_start.size() < arena.size()) {
+      statement_start.resize(arena.size(), NO_START);
+    }
+    statement_start[statement] = static_cast<std::uint32_t>(first);
+  }
+
+  // Declare the variables of those `statements` (all before the edit) that begin with `var`,
+  // in the innermost scope of `scope`.
+  void Declare(SymbolTable &scope, std::span<const emplex::Token> all, std::span<const NodeId> statements) const {
+    for (NodeId statement : statements) {
+      const std::size_t start = statement_start[statement];
+      if (all[start] == Lexer::ID_VAR) {
+        const emplex::Token &name = all[start + 1];
+        scope.AddVar(name.symbol, name.lexeme, name.line_id);
+      }
+    }
+  }
+
+  // Append the name declared by the statement starting at token `start`, if any; `token(i)` looks tokens up.
+  template <typename Lookup>
+  static void DeclaredName(const Lookup &token, std::size_t start, std::vector<Symbol> &names) {
+    if (token(start) == Lexer::ID_VAR) {
+      names.push_back(token(start + 1).symbol);
+    }
+  }
+
+  // Move the children collected since `start` into the arena as `parent`'s child range.
+  void FinishChildren(NodeId parent, std::size_t start) {
+    arena.SetChildren(parent, std::span(pending_children).subspan(start));
+    pending_children.resize(start);
   }
 
 public:
-  Compiler(std::ifstream &file_stream) {
-    tokens = lexer.Tokenize(file_stream);
-    logger << "Hello";
+  Compiler(SourceFile &&source_file, const Options &options = {})
+      : source(std::move(source_file)), options(options),
+        lexed(options.lex_jobs > 1 ? ParallelLexer::Tokenize(source.Text(), &names, options.lex_jobs, options.lex_chunk)
+                                   : std::vector<emplex::Token>{}),
+        tokens(options.lex_jobs > 1 ? TokenStream(lexed) : TokenStream(source.Text(), names, options.lex_thread)) {
+    LOG(DEBUG) << "Hello";
   }
 
+  /// Parse tokens that were already lexed from `source_file`; they must outlive the Compiler.
+  Compiler(SourceFile &&source_file, std::span<const emplex::Token> lexed, const Options &options = {})
+      : source(std::move(source_file)), options(options), tokens(lexed) {}
+
   void parse() {
     // Push initial scope
     table.PushScope();
@@ -103,27 +185,154 @@ public:
     parseTokens(root, table.GetScopeCount());
   }
 
-  void parseTokens(std::shared_ptr<ASTNode> currRoot, std::size_t scopeSizeBefore) {
-    logger << "Started parsing token scope. Current scope: " << scopeSizeBefore << std::endl;
-    while (current_token < tokens.size() && table.GetScopeCount() >= scopeSizeBefore) {
-      currRoot->AddChild(ParseStatement());
+  /// Parse, or load the program `cache` holds for this exact source text.
+  void parse(const ScriptCache &cache, const std::string &path) {
+    std::size_t frame_size = 0;
+    // A cached tree no longer says which statements declare the --bind variables.
+    if (bind_points.empty() && cache.Load(path, source.Text(), arena, root, frame_size)) {
+      table.SetFrameSize(frame_size);
+      return;
+    }
+    parse();
+    cache.Store(path, source.Text(), arena, root, table.GetFrameSize());
+  }
+
+  /**
+   * Bring the program up to date after `edit` turned the tokens into `after`, where
+   * `replaced` holds the old tokens [edit.first, edit.old_end) (--watch; the compiler must
+   * have been built to replay tokens, with options.watch set).
+   * Only the innermost block whose braces the edit left alone is re-parsed, starting
+   * at the statement holding the last token before the edit (its parse may have peeked
+   * at the next one) and stopping at the first later statement that starts at the same
+   * token and sees the same declarations. Names are resolved by re-declaring what the
+   * enclosing blocks declared before that point. Returns false if the edit changed the
+   * block structure, in which case parse() a fresh compiler instead.
+   */
+  bool reparse(std::span<const emplex::Token> after, std::span<const emplex::Token> replaced, const TokenEdit &edit,
+               std::size_t &reparsed) {
+    auto moved = [&edit](std::size_t start) { return start - edit.old_end + edit.new_end; };
+    auto now = [after](std::size_t index) -> const emplex::Token & { return after[index]; };
+    // Token `index` as it was before the edit.
+    auto before = [&](std::size_t index) -> const emplex::Token & {
+      return index < edit.first     ? after[index]
+             : index < edit.old_end ? replaced[index - edit.first]
+                                    : after[moved(index)];
+    };
+    // Statements beginning at or before the last unchanged token, among `statements`.
+    auto kept = [&](std::span<const NodeId> statements) -> std::size_t {
+      if (edit.first == 0) {
+        return 0;
+      }
+      return static_cast<std::size_t>(std::partition_point(statements.begin(), statements.end(),
+                                                           [&](NodeId id) { return statement_start[id] < edit.first; }) -
+                                      statements.begin());
+    };
+
+    SymbolTable scope;
+    scope.PushScope();
+    NodeId block = root;
+    std::span<const NodeId> statements = arena.GetChildren(block);
+    std::size_t from = kept(statements);
+    while (from > 0 && arena[statements[from - 1]].GetType() == ASTNode::STATEMENT_BLOCK) {
+      const NodeId inner = statements[from - 1];
+      auto body = arena.GetChildren(inner);
+      const std::size_t close = body.empty() ? NO_START : statement_start[body.back()];
+      if (close == NO_START || before(close) != Lexer::ID_CLOSE_SCOPE || close < edit.old_end) {
+        break; // Unclosed, or the edit reaches its '}'
+      }
+      Declare(scope, after, statements.first(from - 1));
+      scope.PushScope();
+      block = inner;
+      statements = body;
+      from = kept(statements);
+    }
+    const std::size_t first = from > 0 ? from - 1 : 0; // First statement to replace
+    Declare(scope, after, statements.first(first));
+
+    const std::vector<NodeId> old_statements(statements.begin(), statements.end()); // Parsing moves the arena
+    std::vector<NodeId> merged(old_statements.begin(), old_statements.begin() + static_cast<std::ptrdiff_t>(first));
+    const std::size_t level = scope.GetScopeCount();
+    const std::size_t frame_size = table.GetFrameSize();
+    const std::size_t old_count = std::min(arena.size(), statement_start.size());
+    table = std::move(scope);
+    tokens.Replay(after, from > 0 ? statement_start[old_statements[first]] : edit.first);
+
+    std::vector<Symbol> old_names, new_names;
+    std::size_t next = first; // First old statement not yet replaced
+    for (;;) {
+      const std::size_t position = tokens.Position();
+      while (next < old_statements.size()) {
+        const std::size_t start = statement_start[old_statements[next]];
+        if (start >= edit.old_end && moved(start) >= position) {
+          break;
+        }
+        DeclaredName(before, start, old_names);
+        ++next;
+      }
+      const bool closing = block != root && next + 1 == old_statements.size(); // Only the '}' is left
+      if (next < old_statements.size() && moved(statement_start[old_statements[next]]) == position &&
+          (closing || old_names == new_names)) {
+        break; // The rest of the block parses just as before
+      }
+      if (tokens.AtEnd()) {
+        if (block != root) {
+          return false;
+        }
+        next = old_statements.size();
+        break;
+      }
+      const NodeId statement = ParseStatement();
+      RecordStart(statement, position);
+      merged.push_back(statement);
+      DeclaredName(now, position, new_names);
+      ++reparsed;
+      if (table.GetScopeCount() != level) {
+        return false; // A '}' closed the block early, or a '{' was left open
+      }
+    }
+    merged.insert(merged.end(), old_statements.begin() + static_cast<std::ptrdiff_t>(next), old_statements.end());
+    arena.SetChildren(block, merged);
+    table.SetFrameSize(std::max(frame_size, table.GetFrameSize()));
+
+    // Statements after the edit keep their trees; only their tokens and lines moved.
+    if (edit.new_end != edit.old_end || edit.line_shift != 0) {
+      for (NodeId id = 0; id < old_count; ++id) {
+        std::uint32_t &start = statement_start[id];
+        if (start != NO_START && start >= edit.old_end) {
+          start = static_cast<std::uint32_t>(moved(start));
+          if (edit.line_shift != 0) {
+            arena.ShiftLines(id, edit.line_shift);
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  void parseTokens(NodeId currRoot, std::size_t scopeSizeBefore) {
+    LOG(DEBUG) << "Started parsing token scope. Current scope: " << scopeSizeBefore;
+    const std::size_t start = pending_children.size();
+    while (!tokens.AtEnd() && table.GetScopeCount() >= scopeSizeBefore) {
+      const std::size_t first = tokens.Position();
+      NodeId statement = ParseStatement();
+      RecordStart(statement, first);
+      pending_children.push_back(statement);
     }
+    FinishChildren(currRoot, start);
 
-    logger << "Ended parsing token scope. Current scope: " << table.GetScopeCount() << std::endl;
+    LOG(DEBUG) << "Ended parsing token scope. Current scope: " << table.GetScopeCount();
     // After parsing, check if there are any open brackets
     std::size_t scopeSizeAfter = table.GetScopeCount();
     if (scopeSizeBefore - scopeSizeAfter > 1) {
-      std::size_t tokenPost = current_token;
-      if (current_token >= tokens.size())
-        --tokenPost;
-      emplex::Token lastToken = tokens.at(tokenPost);
-      throw Err(lastToken.line_id, "Expected }");
+      const emplex::Token *next = tokens.Peek();
+      throw Err(next ? next->line_id : tokens.GetLastLine(), "Expected }");
     }
   }
 
-  std::shared_ptr<ASTNode> ParseStatement() {
-    logger << "Parsing " << emplex::Lexer::TokenName(tokens.at(current_token)) << " : " << tokens.at(current_token).lexeme << std::endl;
-    switch (tokens.at(current_token)) {
+  NodeId ParseStatement() {
+    const emplex::Token &current = *tokens.Peek();
+    LOG(DEBUG) << "Parsing " << emplex::Lexer::TokenName(current) << " : " << current.lexeme;
+    switch (current) {
       case Lexer::ID_VAR:
         return ParseVar();
       case Lexer::ID_PRINT:
@@ -137,104 +346,221 @@ public:
       case Lexer::ID_END_OF_LINE:
       default:
         MoveNext();
-        return std::make_shared<ASTNode>(ASTNode());
+        return arena.Add();
     }
   }
 
-  std::shared_ptr<ASTNode> ParseVar() {
+  NodeId ParseVar() {
     auto assingToken = UseToken();
     auto varName = GetCurrent(Lexer::ID_ID, "'var' must be proceeded by variable name");
 
-    size_t varId = table.AddVar(varName.lexeme, varName.line_id);
+    size_t varId = table.AddVar(varName.symbol, varName.lexeme, varName.line_id);
 
+    NodeId statement;
     if (UseNextTokenIf(Lexer::ID_END_OF_LINE)) {
-      return std::make_shared<ASTNode>(ASTNode{});
+      // Slots are shared with earlier sibling scopes, so clear out any stale value.
+      statement = MakeAssign(varName.line_id, varId, 0.0);
+    } else {
+      statement = ParseId();
+      ZeroReads(arena.GetChildren(statement)[1], varId);
     }
+    if (!bind_points.empty() && table.GetScopeCount() == 1) {
+      RecordBindPoint(varName.lexeme, statement);
+    }
+    return statement;
+  }
+
+  // Replace every read of `slot` under `id` with 0. A variable reads as 0 in its own
+  // initializer, but its slot may still hold what an earlier sibling scope left there.
+  // Every other read follows the declaration's store, so reused slots need no clearing.
+  void ZeroReads(NodeId id, std::size_t slot) {
+    if (arena[id].GetType() == ASTNode::VARIABLE && arena[id].GetId() == slot) {
+      arena.ReplaceWithValue(id, 0.0);
+      return;
+    }
+    for (NodeId child : arena.GetChildren(id)) {
+      ZeroReads(child, slot);
+    }
+  }
 
-    return ParseId();
+  void RecordBindPoint(std::string_view name, NodeId statement) {
+    for (std::size_t i = 0; i < bind_points.size(); ++i) {
+      if (options.bindings[i].name == name) {
+        bind_points[i] = statement;
+      }
+    }
   }
 
   /**
    * Expect to be at the start of the expression
    */
-  std::shared_ptr<ASTNode> ParseExpression() {
-    logger << "Parsing expression" << std::endl;
-    std::shared_ptr<ASTNode> node = std::make_shared<ASTNode>(ASTNode(ASTNode::Type::EXPRESSION));
+  NodeId ParseExpression() {
+    LOG(DEBUG) << "Parsing expression";
+    NodeId node = arena.Add(ASTNode::Type::EXPRESSION);
 
-    auto term = ParseTerm();
-    node->AddChild(term);
+    NodeId term = ParseTerm();
+    arena.SetChildren(node, std::span(&term, 1));
 
     return node;
   }
 
-  std::shared_ptr<ASTNode> ParseTerm() {
+  NodeId ParseTerm() {
     auto term = UseToken();
-    logger << "Parsing term " << term.lexeme << std::endl;
+    LOG(DEBUG) << "Parsing term " << term.lexeme;
 
     switch (term) {
       case Lexer::ID_ID: {
-        auto node = std::make_shared<ASTNode>(ASTNode(ASTNode::VARIABLE, term));
-        node->SetId(table.GetIdByName(term.line_id, term.lexeme));
+        NodeId node = arena.Add(ASTNode::VARIABLE, term.line_id);
+        arena[node].SetId(table.GetIdBySymbol(term.line_id, term.symbol, term.lexeme));
         return node;
       }
       case Lexer::ID_NUMBER: {
-        auto node = std::make_shared<ASTNode>(ASTNode(ASTNode::VALUE, term));
-        node->SetValue(std::stod(term.lexeme));
+        NodeId node = arena.Add(ASTNode::VALUE, term.line_id);
+        double value = 0.0;
+        auto [end, error] = std::from_chars(term.lexeme.data(), term.lexeme.data() + term.lexeme.size(), value);
+        if (error != std::errc{} || end != term.lexeme.data() + term.lexeme.size()) {
+          throw Err(term, "Invalid number '", term.lexeme, "'");
+        }
+        arena[node].SetValue(value);
         return node;
       }
       default:
-        return std::make_shared<ASTNode>(ASTNode());
+        return arena.Add();
     }
   }
 
-  std::shared_ptr<ASTNode> ParsePrint() {
+  NodeId ParsePrint() {
     auto printToken = UseToken(Lexer::ID_PRINT);
-    auto next = UseToken('(');
-    auto node = std::make_shared<ASTNode>(ASTNode(ASTNode::PRINT, printToken));
+    UseToken('(');
+    NodeId node = arena.Add(ASTNode::PRINT, printToken.line_id);
+    const std::size_t start = pending_children.size();
     do {
-      auto expression = ParseExpression();
-      node->AddChild(expression);
+      NodeId expression = ParseExpression();
+      pending_children.push_back(expression);
     } while (UseTokenIf(','));
+    FinishChildren(node, start);
 
     return node;
   }
 
-  std::shared_ptr<ASTNode> ParseId() {
+  NodeId ParseId() {
     auto idToken = UseToken(Lexer::ID_ID);
     auto assignToken = UseToken(Lexer::ID_ASSIGN);
 
-    auto node = std::make_shared<ASTNode>(ASTNode(ASTNode::ASSIGN, assignToken));
+    NodeId node = arena.Add(ASTNode::ASSIGN, assignToken.line_id);
 
-    auto var = std::make_shared<ASTNode>(ASTNode(ASTNode::VARIABLE, idToken));
-    var->SetId(table.GetIdByName(idToken, idToken.lexeme));
-    node->AddChild(var);
+    NodeId var = arena.Add(ASTNode::VARIABLE, idToken.line_id);
+    arena[var].SetId(table.GetIdBySymbol(idToken.line_id, idToken.symbol, idToken.lexeme));
 
-    auto expression = ParseExpression();
-    node->AddChild(expression);
+    NodeId expression = ParseExpression();
+    const NodeId operands[] = {var, expression};
+    arena.SetChildren(node, operands);
 
     UseToken(Lexer::ID_END_OF_LINE);
     return node;
   }
 
-  std::shared_ptr<ASTNode> ParseOpenScope() {
+  // Build `slot = value` without any source tokens behind it.
+  NodeId MakeAssign(std::size_t line, std::size_t slot, double value) {
+    NodeId var = arena.Add(ASTNode::VARIABLE, line);
+    arena[var].SetId(slot);
+    NodeId term = arena.Add(ASTNode::VALUE, line);
+    arena[term].SetValue(value);
+    NodeId expression = arena.Add(ASTNode::EXPRESSION, line);
+    arena.SetChildren(expression, std::span(&term, 1));
+
+    NodeId node = arena.Add(ASTNode::ASSIGN, line);
+    const NodeId operands[] = {var, expression};
+    arena.SetChildren(node, operands);
+    return node;
+  }
+
+  NodeId ParseOpenScope() {
     auto openToken = GetCurrent();
-    auto statementBlockToken = std::make_shared<ASTNode>(ASTNode(ASTNode::Type::STATEMENT_BLOCK, openToken));
+    NodeId statementBlock = arena.Add(ASTNode::Type::STATEMENT_BLOCK, openToken.line_id);
 
     table.PushScope();
 
     MoveNext();
 
-    parseTokens(statementBlockToken, table.GetScopeCount());
+    parseTokens(statementBlock, table.GetScopeCount());
 
-    return statementBlockToken;
+    return statementBlock;
   }
 
-  std::shared_ptr<ASTNode> ParseCloseScope() {
+  NodeId ParseCloseScope() {
+    UseToken(Lexer::ID_CLOSE_SCOPE);
     table.PopScope();
-    return std::make_shared<ASTNode>(ASTNode());
+    return arena.Add();
+  }
+
+  /// Take a copy of the program `parsed` holds, to optimize and run while `parsed` stays as it was.
+  void load(const Compiler &parsed) {
+    arena.Assign(parsed.arena.GetNodes(), parsed.arena.GetChildIds());
+    root = parsed.root;
+    table.SetFrameSize(parsed.table.GetFrameSize());
+  }
+
+  void optimize() {
+    if (!bind_points.empty()) {
+      // Propagating a declaration's value would bake in what each lane overrides.
+      LOG(INFO) << "Lane evaluation runs the program as parsed";
+      return;
+    }
+    Optimizer::Run(arena, root, options.opt_level, table.GetFrameSize());
+    if (options.engine == Engine::TREE) {
+      Superinstructions::Run(arena, root); // The bytecode back ends fuse while lowering instead
+    }
+  }
+
+  void lower() {
+    MemoryTag tag(Structure::BYTECODE);
+    program = Bytecode::Lower(arena, root);
+    if (options.engine == Engine::NATIVE) {
+      native = JIT::Compile(*program);
+    }
+  }
+
+  /// True if execute() runs the lowered program (on the VM or as native code).
+  bool RunsBytecode() const {
+    return options.engine != Engine::TREE && bind_points.empty() && !Governor::Enabled(options) && !options.profile;
   }
 
   void execute() {
-    root->Run(table);
+    if (!bind_points.empty()) {
+      if (options.engine != Engine::TREE) {
+        LOG(INFO) << "Lane evaluation has its own interpreter";
+      }
+      Lanes::Run(arena, root, table.GetFrameSize(), bind_points, options.bindings);
+      return;
+    }
+    if (Governor::Enabled(options)) {
+      if (options.engine != Engine::TREE) {
+        LOG(INFO) << "Resource limits run the program on the tree walker";
+      }
+      Governor::Run(arena, root, table, options);
+      return;
+    }
+    if (options.profile) {
+      if (options.engine != Engine::TREE) {
+        LOG(INFO) << "Profiling runs the tree walker";
+      }
+      Profiler::Run(arena, root, table, options.profile_file);
+      return;
+    }
+    if (RunsBytecode()) {
+      if (!program) {
+        lower();
+      }
+      if (native) {
+        native->Run(*program, table);
+      } else {
+        VM::Run(*program, table);
+      }
+      return;
+    }
+    arena[root].Run(arena, table);
   }
+
+  std::size_t GetNodeCount() const { return arena.size(); }
 };
\ No newline at end of file
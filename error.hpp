@@ -1,29 +1,55 @@
 #pragma once
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include "lexer.hpp"
 
+// A compile error in the script being run. The caller decides what to do with
+// it (main prints it and exits; --batch records it against one script).
 class Err : public std::exception {
 public:
   template <typename... Ts>
   explicit Err(size_t line_num, Ts... message) {
-    std::cerr << "ERROR (line " << line_num << "): ";
-    (std::cerr << ... << message);
-    std::cerr << std::endl;
-    exit(1);
+    std::ostringstream text;
+    text << "ERROR (line " << line_num << "): ";
+    (text << ... << message);
+    message_ = text.str();
   }
 
   template <typename... Ts>
-  explicit Err(emplex::Token token, Ts... message) {
-    Err(token.line_id, message...);
-  }
+  explicit Err(emplex::Token token, Ts... message)
+      : Err(token.line_id, message...) {}
 
   // Override the what() function to provide the error message
   virtual const char *what() const noexcept override {
     return message_.c_str();
   }
 
+  /// Exit status for a script stopped by this error.
+  int Status() const { return status_; }
+
+protected:
+  Err(int status, std::string message)
+      : message_(std::move(message)), status_(status) {}
+
 private:
   std::string message_;
-};
\ No newline at end of file
+  int status_ = 1;
+};
+
+// A script stopped by a resource limit (see Governor.hpp) rather than an error in it.
+class LimitErr : public Err {
+public:
+  static constexpr int EXIT_STATUS = 3;
+
+  LimitErr(size_t line_num, const std::string &what)
+      : Err(EXIT_STATUS, "LIMIT EXCEEDED (line " + std::to_string(line_num) + "): " + what) {}
+};
+
+// A problem with how the script was invoked (e.g. a --bind naming no variable) rather than with the script.
+class UsageErr : public Err {
+public:
+  explicit UsageErr(const std::string &what)
+      : Err(1, "ERROR: " + what) {}
+};
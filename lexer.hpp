@@ -5,15 +5,19 @@
 #include <array>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "Interner.hpp"
+
 namespace emplex {
   // Struct to store information about a found Token
   struct Token {
     int id;                             // Type ID for token
-    std::string lexeme;                 // Sequence matched by token
+    std::string_view lexeme;            // Sequence matched by token (views the lexed text)
     size_t line_id;                     // Line token started on
+    Symbol symbol = 0;                  // Interned lexeme (ID tokens only)
     operator int() const { return id; } // Auto-convert tokens to IDs
   };
 
@@ -106,8 +110,10 @@ namespace emplex {
     // -- Current State --
     size_t cur_line = 1;  // Track LINE we are reading in the input.
     int start_pos = 0;    // Track INDEX for the start of current lexeme.
-    std::string lexeme{}; // Lexeme found for the current token
-    std::string errors{}; // Description of any errors encountered
+    std::string_view lexeme{}; // Lexeme found for the current token
+    std::string errors{};      // Description of any errors encountered
+    std::string source{};      // Owns the text when tokenizing from a stream
+    Interner *interner = nullptr; // Symbol table for ID lexemes, if any
 
   public:
     static constexpr int ID__EOF_ = 0;
@@ -181,6 +187,9 @@ namespace emplex {
       };
     }
 
+    // Intern ID lexemes into this table from now on.
+    void SetInterner(Interner *table) { interner = table; }
+
     // Return the number of token types the lexer recognizes.
     static constexpr int GetNumTokens() { return NUM_TOKENS; }
 
@@ -239,6 +248,9 @@ namespace emplex {
       cur_line += static_cast<size_t>(std::count(lexeme.begin(), lexeme.end(), '\n'));
 
       // Return the token we found.
+      if (best_stop == ID_ID && interner != nullptr) {
+        return {best_stop, lexeme, out_line, interner->Intern(lexeme)};
+      }
       return {best_stop, lexeme, out_line};
     }
 
@@ -255,9 +267,10 @@ namespace emplex {
     }
 
     // Convert an input stream to a string, then tokenize.
+    // Lexemes view the lexer's copy of the text, so they live as long as the lexer.
     std::vector<Token> Tokenize(std::istream &is) {
-      return Tokenize(
-          std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()));
+      source.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+      return Tokenize(std::string_view(source));
     }
   };
 } // End of namespace emplex
@@ -1,49 +1,194 @@
 #pragma once
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <streambuf>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 
-bool shouldLog;
+// Verbosity of a log record. Records above MC_LOG_LEVEL are compiled out, so
+// they cost nothing at all; the rest only run when -v sets shouldLog.
+enum class LogLevel {
+  INFO = 1,  // Once-per-run summaries
+  DEBUG = 2, // Parser decisions
+  TRACE = 3, // Every node the interpreter visits
+};
+
+#ifndef MC_LOG_LEVEL
+#ifdef NDEBUG
+#define MC_LOG_LEVEL 1 // Release builds keep INFO only
+#else
+#define MC_LOG_LEVEL 3
+#endif
+#endif
 
+thread_local bool shouldLog; // Per thread, so --batch can log some scripts and not others
+
+// Collects log records from any thread into a lock-free ring buffer; a
+// background thread, started by the first record, writes them to stderr and
+// to log.txt (which is only created once something is logged). A thread that
+// captures its records (--batch and --serve scripts) keeps them out of the ring.
 class Logger {
-public:
-  Logger()
-      : log_stream(&std::cout) {}
-
-  // Overload the << operator for the logger
-  template <typename T>
-  Logger &operator<<(const T &value) {
-    if (shouldLog) {
-      std::stringstream ss;
-      ss << value;
-      // Output to the console
-      (*log_stream) << ss.str();
-      // Optionally, also output to a file
-      logfile << ss.str();
-    }
-    return *this;
+private:
+  static constexpr std::size_t SLOTS = 4096; // Must be a power of two
+  static constexpr std::size_t RECORD_SIZE = 240;
+
+  struct Slot {
+    std::atomic<std::size_t> sequence;
+    std::size_t length;
+    char text[RECORD_SIZE];
+  };
+
+  std::unique_ptr<Slot[]> slots{};
+  alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+  alignas(64) std::size_t dequeue_pos = 0; // Only touched by the drain thread
+  std::atomic<bool> stop{false};
+  std::once_flag started{};
+  std::thread drainer{};
+  static inline thread_local std::string *capture = nullptr;
+
+  void Start() {
+    slots = std::make_unique<Slot[]>(SLOTS);
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    drainer = std::thread([this] { Drain(); });
   }
 
-  // Flush the log stream (usually after an endl)
-  Logger &operator<<(std::ostream &(*manip)(std::ostream &)) {
-    if (shouldLog) {
-      manip(*log_stream);   // Apply manipulator like std::endl
-      logfile << std::endl; // Also apply to the log file
+  // Bounded multi-producer queue (Vyukov); producers only wait if the drain thread falls a full ring behind.
+  void Push(const char *text, std::size_t length) {
+    std::call_once(started, [this] { Start(); });
+    std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+      slot = &slots[pos & (SLOTS - 1)];
+      const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      if (sequence == pos) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (sequence < pos) {
+        std::this_thread::yield(); // Ring is full
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
     }
-    return *this;
+    std::memcpy(slot->text, text, length);
+    slot->length = length;
+    slot->sequence.store(pos + 1, std::memory_order_release);
   }
 
-  // Destructor to close the log file
-  ~Logger() {
-    if (logfile.is_open()) {
-      logfile.close();
+  void Drain() {
+    std::FILE *logfile = nullptr;
+    for (;;) {
+      Slot &slot = slots[dequeue_pos & (SLOTS - 1)];
+      if (slot.sequence.load(std::memory_order_acquire) == dequeue_pos + 1) {
+        if (logfile == nullptr) {
+          logfile = std::fopen("log.txt", "w");
+        }
+        std::fwrite(slot.text, 1, slot.length, stderr);
+        if (logfile != nullptr) {
+          std::fwrite(slot.text, 1, slot.length, logfile);
+        }
+        slot.sequence.store(dequeue_pos + SLOTS, std::memory_order_release);
+        ++dequeue_pos;
+        continue;
+      }
+      if (stop.load(std::memory_order_acquire) && enqueue_pos.load(std::memory_order_acquire) == dequeue_pos) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    if (logfile != nullptr) {
+      std::fclose(logfile);
     }
+    std::fflush(stderr);
   }
 
-private:
-  std::ostream *log_stream;         // Pointer to the stream (e.g., std::cout)
-  std::ofstream logfile{"log.txt"}; // Log file for writing logs
+public:
+  // One line of log output, built up with << and queued when the statement ends.
+  class Record {
+  private:
+    Logger &logger;
+    char text[RECORD_SIZE];
+    std::size_t length = 0;
+
+    void Append(std::string_view piece) {
+      const std::size_t count = std::min(piece.size(), RECORD_SIZE - 1 - length);
+      std::memcpy(text + length, piece.data(), count);
+      length += count;
+    }
+
+  public:
+    explicit Record(Logger &logger)
+        : logger(logger) {}
+    Record(const Record &) = delete;
+    Record &operator=(const Record &) = delete;
+    ~Record() {
+      text[length++] = '\n';
+      if (capture != nullptr) {
+        capture->append(text, length);
+      } else {
+        logger.Push(text, length);
+      }
+    }
+
+    template <typename T>
+    Record &operator<<(const T &value) {
+      if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        Append(value);
+      } else if constexpr (std::is_same_v<T, char>) {
+        Append(std::string_view(&value, 1));
+      } else if constexpr (std::is_enum_v<T>) {
+        *this << static_cast<std::underlying_type_t<T>>(value);
+      } else {
+        static_assert(std::is_arithmetic_v<T>, "Log values must be text, numbers or enums");
+        char buffer[32];
+        Append(std::string_view(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr));
+      }
+      return *this;
+    }
+
+    // Records always end with a newline; accept std::endl and friends for convenience.
+    Record &operator<<(std::ostream &(*)(std::ostream &)) { return *this; }
+  };
+
+  Logger() = default;
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  Record Write() { return Record(*this); }
+
+  /// Append this thread's records to `sink` instead of logging them (nullptr restores the log).
+  static void SetCapture(std::string *sink) { capture = sink; }
+
+  // Flush everything that was logged and stop the drain thread.
+  ~Logger() {
+    if (drainer.joinable()) {
+      stop.store(true, std::memory_order_release);
+      drainer.join();
+    }
+  }
 };
 
 // Define the log object
-Logger logger;
\ No newline at end of file
+Logger logger;
+
+// Usage: LOG(DEBUG) << "Parsed " << count << " nodes";
+// The switch keeps the macro one statement, so an `else` after it binds to the caller's `if`.
+#define LOG(level)                                                          \
+  switch (0)                                                                \
+  default:                                                                  \
+    if constexpr (static_cast<int>(LogLevel::level) > MC_LOG_LEVEL) {       \
+    } else if (!shouldLog) {                                                \
+    } else                                                                  \
+      logger.Write()
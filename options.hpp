@@ -0,0 +1,285 @@
+#pragma once
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Which back end runs the parsed program.
+enum class Engine {
+  TREE,     // Recursive ASTNode::Run walk (default)
+  BYTECODE, // Lowered to flat bytecode and run on the VM
+  NATIVE,   // Bytecode compiled to x86-64 machine code; see JIT.hpp
+};
+
+// A --bind: the values one top-level variable takes, one per lane (a single value is shared by every lane).
+struct Binding {
+  std::string name;
+  std::vector<double> values;
+};
+
+struct Options {
+  std::string filename;
+  bool verbose = false;
+  Engine engine = Engine::TREE;
+  bool lex_thread = false; // Lex on a second thread while parsing
+  int lex_jobs = 0;        // --lex-jobs=N: lex large inputs up front on N threads; see ParallelLexer.hpp
+  std::size_t lex_chunk = std::size_t(1) << 20; // --lex-chunk=N (unlisted): fewest bytes per --lex-jobs thread, for tests
+  int opt_level = 0;       // -O<n>; see Optimizer.hpp
+  int bench_runs = 0;      // --bench[=N]: time each phase N times instead of running once
+  std::string bench_format = "json";
+  bool batch = false;                   // --batch: run every listed script in one process
+  std::vector<std::string> batch_files; // Scripts named on the command line
+  std::string manifest;                 // File listing more scripts for --batch, one per line
+  int jobs = 0;                         // -j<N>: --batch/--serve worker threads (0 = one per core)
+  std::string serve_socket;             // --serve <socket>: run as a daemon; see Server.hpp
+  bool cache = false;                   // --cache[=dir]: reuse parsed programs; see ScriptCache.hpp
+  std::string cache_dir;                // Empty means ScriptCache::DefaultDirectory()
+  bool profile = false;                 // --profile[=file]: per-line profile; see Profiler.hpp
+  std::string profile_file = "profile.folded"; // Folded stacks for flamegraph tools
+  std::uint64_t max_steps = 0;          // --max-steps=N: statements a script may run (0 = no limit)
+  double timeout = 0.0;                 // --timeout=S: seconds of execution allowed; see Governor.hpp
+  std::uint64_t max_mem_mb = 0;         // --max-mem=MB: cap on the process's resident memory
+  bool watch = false;                   // --watch: re-run the script whenever it changes; see Watch.hpp
+  std::vector<Binding> bindings;        // --bind=name=values: run once per value, lane-parallel; see Lanes.hpp
+  bool mem_report = false;              // --mem-report[=file]: heap use by phase and structure; see MemoryReport.hpp
+  std::string mem_report_file = "mem-report.txt"; // Summary for diffing between builds
+};
+
+inline void PrintUsage(const char *program) {
+  std::cout << "Format: " << program << " [filename] [-v] [--watch] [-O<level>] [--vm|--jit] [--lex-thread] [--lex-jobs=N] [--cache[=dir]] [--profile[=file]] [--mem-report[=file]] [--bench[=N]] [--bench-format=json|csv]\n"
+            << "       " << program << " [filename] --bind=name=v1,v2,...|first..last [--bind=...] [flags]  (one run per value)\n"
+            << "       " << program << " [filename] [--max-steps=N] [--timeout=seconds] [--max-mem=MB] [flags]  (exit 3 when a limit is hit)\n"
+            << "       " << program << " --batch [filename...] [--manifest=file] [-j<N>] [flags]\n"
+            << "       " << program << " --serve <socket> [-j<N>] [flags]" << std::endl;
+}
+
+/// Read a positive whole number that makes up all of `text`.
+inline bool ParseLimit(const char *text, std::uint64_t &value) {
+  char *end = nullptr;
+  value = std::strtoull(text, &end, 10);
+  return value > 0 && *end == '\0' && *text != '-';
+}
+
+/// Most lanes a set of --bind values may describe.
+constexpr std::size_t MAX_LANES = std::size_t{1} << 24;
+
+/// Read a number that makes up all of `text`.
+inline bool ParseNumber(std::string_view text, double &value) {
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return !text.empty() && error == std::errc{} && end == text.data() + text.size();
+}
+
+/// Read "name=v1,v2,..." where each item is a number or a whole-number range "first..last".
+inline bool ParseBinding(const std::string &text, Binding &binding) {
+  const std::size_t equals = text.find('=');
+  if (equals == 0 || equals == std::string::npos) {
+    return false;
+  }
+  binding.name = text.substr(0, equals);
+  for (char c : binding.name) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+      return false;
+    }
+  }
+  if (std::isdigit(static_cast<unsigned char>(binding.name[0]))) {
+    return false;
+  }
+  std::string_view items = std::string_view(text).substr(equals + 1);
+  while (true) {
+    const std::size_t comma = items.find(',');
+    const std::string_view item = items.substr(0, comma);
+    const std::size_t dots = item.find("..");
+    double first = 0.0;
+    if (!ParseNumber(item.substr(0, dots), first)) {
+      return false;
+    }
+    if (dots == std::string_view::npos) {
+      binding.values.push_back(first);
+    } else {
+      double last = 0.0;
+      if (!ParseNumber(item.substr(dots + 2), last) || first != std::trunc(first) || last != std::trunc(last) ||
+          last < first || last - first >= static_cast<double>(MAX_LANES)) {
+        return false;
+      }
+      const auto count = static_cast<std::size_t>(last - first) + 1;
+      for (std::size_t i = 0; i < count; ++i) {
+        binding.values.push_back(first + static_cast<double>(i));
+      }
+    }
+    if (binding.values.size() > MAX_LANES) {
+      return false;
+    }
+    if (comma == std::string_view::npos) {
+      return true;
+    }
+    items.remove_prefix(comma + 1);
+  }
+}
+
+/// Fill in options from the command line; returns false if the arguments are unusable.
+inline bool ParseOptions(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-v") {
+      options.verbose = true;
+    } else if (arg == "--vm") {
+      options.engine = Engine::BYTECODE;
+    } else if (arg == "--jit") {
+      options.engine = Engine::NATIVE;
+    } else if (arg == "--lex-thread") {
+      options.lex_thread = true;
+    } else if (arg.starts_with("--lex-jobs=")) {
+      options.lex_jobs = std::atoi(arg.c_str() + 11);
+      if (options.lex_jobs <= 0) {
+        std::cout << "ERROR: --lex-jobs needs a positive thread count." << std::endl;
+        return false;
+      }
+    } else if (arg.starts_with("--lex-chunk=")) {
+      const long long bytes = std::atoll(arg.c_str() + 12);
+      if (bytes <= 0) {
+        std::cout << "ERROR: --lex-chunk needs a positive byte count." << std::endl;
+        return false;
+      }
+      options.lex_chunk = static_cast<std::size_t>(bytes);
+    } else if (arg == "--cache") {
+      options.cache = true;
+    } else if (arg.starts_with("--cache=")) {
+      options.cache = true;
+      options.cache_dir = arg.substr(8);
+    } else if (arg == "--profile") {
+      options.profile = true;
+    } else if (arg.starts_with("--profile=")) {
+      options.profile = true;
+      options.profile_file = arg.substr(10);
+    } else if (arg == "--mem-report") {
+      options.mem_report = true;
+    } else if (arg.starts_with("--mem-report=")) {
+      options.mem_report = true;
+      options.mem_report_file = arg.substr(13);
+    } else if (arg.starts_with("--max-steps=")) {
+      if (!ParseLimit(arg.c_str() + 12, options.max_steps)) {
+        std::cout << "ERROR: --max-steps needs a positive whole number." << std::endl;
+        return false;
+      }
+    } else if (arg.starts_with("--max-mem=")) {
+      if (!ParseLimit(arg.c_str() + 10, options.max_mem_mb)) {
+        std::cout << "ERROR: --max-mem needs a positive whole number of megabytes." << std::endl;
+        return false;
+      }
+    } else if (arg.starts_with("--timeout=")) {
+      char *end = nullptr;
+      options.timeout = std::strtod(arg.c_str() + 10, &end);
+      if (!(options.timeout > 0.0) || *end != '\0') {
+        std::cout << "ERROR: --timeout needs a positive number of seconds." << std::endl;
+        return false;
+      }
+    } else if (arg.starts_with("--bind=")) {
+      Binding binding;
+      if (!ParseBinding(arg.substr(7), binding)) {
+        std::cout << "ERROR: --bind needs name=values, e.g. --bind=n=1,2,3 or --bind=n=1..100." << std::endl;
+        return false;
+      }
+      options.bindings.push_back(std::move(binding));
+    } else if (arg == "--watch") {
+      options.watch = true;
+    } else if (arg == "--bench") {
+      options.bench_runs = 10;
+    } else if (arg.starts_with("--bench=")) {
+      options.bench_runs = std::atoi(arg.c_str() + 8);
+      if (options.bench_runs <= 0) {
+        std::cout << "ERROR: --bench needs a positive run count." << std::endl;
+        return false;
+      }
+    } else if (arg == "--bench-format=json" || arg == "--bench-format=csv") {
+      options.bench_format = arg.substr(15);
+    } else if (arg == "--batch") {
+      options.batch = true;
+    } else if (arg.starts_with("--manifest=")) {
+      options.batch = true;
+      options.manifest = arg.substr(11);
+    } else if (arg == "--serve" || arg.starts_with("--serve=")) {
+      if (arg == "--serve" && i + 1 == argc) {
+        std::cout << "ERROR: --serve needs a socket path." << std::endl;
+        return false;
+      }
+      options.serve_socket = arg == "--serve" ? argv[++i] : arg.substr(8);
+    } else if (arg.starts_with("-j")) {
+      options.jobs = std::atoi(arg.c_str() + 2);
+      if (options.jobs <= 0) {
+        std::cout << "ERROR: -j needs a positive thread count." << std::endl;
+        return false;
+      }
+    } else if (arg == "-O") {
+      options.opt_level = 1;
+    } else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '9') {
+      options.opt_level = arg[2] - '0';
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::cout << "ERROR: Unknown option '" << arg << "'." << std::endl;
+      return false;
+    } else {
+      options.batch_files.push_back(arg);
+    }
+  }
+  if (options.profile && (options.batch || !options.serve_socket.empty())) {
+    std::cout << "ERROR: --profile runs a single script." << std::endl;
+    return false;
+  }
+  if (options.profile && (options.max_steps > 0 || options.timeout > 0.0 || options.max_mem_mb > 0)) {
+    std::cout << "ERROR: --profile cannot be combined with --max-steps, --timeout or --max-mem." << std::endl;
+    return false;
+  }
+  if (options.mem_report && (options.batch || !options.serve_socket.empty() || options.watch || options.bench_runs > 0)) {
+    std::cout << "ERROR: --mem-report runs a single script and cannot be combined with --watch or --bench." << std::endl;
+    return false;
+  }
+  if (options.watch && (options.batch || !options.serve_socket.empty() || options.bench_runs > 0)) {
+    std::cout << "ERROR: --watch runs a single script and cannot be combined with --bench." << std::endl;
+    return false;
+  }
+  if (!options.bindings.empty()) {
+    if (options.batch || !options.serve_socket.empty() || options.watch || options.bench_runs > 0 || options.profile ||
+        options.max_steps > 0 || options.timeout > 0.0 || options.max_mem_mb > 0) {
+      std::cout << "ERROR: --bind runs a single script and cannot be combined with --watch, --bench, --profile or limits."
+                << std::endl;
+      return false;
+    }
+    std::size_t lanes = 1;
+    for (std::size_t i = 0; i < options.bindings.size(); ++i) {
+      const Binding &binding = options.bindings[i];
+      for (std::size_t j = 0; j < i; ++j) {
+        if (options.bindings[j].name == binding.name) {
+          std::cout << "ERROR: '" << binding.name << "' is bound more than once." << std::endl;
+          return false;
+        }
+      }
+      if (binding.values.size() > 1) {
+        if (lanes > 1 && binding.values.size() != lanes) {
+          std::cout << "ERROR: Every --bind needs the same number of values (or just one)." << std::endl;
+          return false;
+        }
+        lanes = binding.values.size();
+      }
+    }
+  }
+  if (options.batch) {
+    return !options.batch_files.empty() || !options.manifest.empty();
+  }
+  if (!options.serve_socket.empty()) {
+    return options.batch_files.empty();
+  }
+  if (options.batch_files.size() > 1) {
+    std::cout << "ERROR: Unexpected argument '" << options.batch_files[1] << "'." << std::endl;
+    return false;
+  }
+  if (options.batch_files.empty()) {
+    return false;
+  }
+  options.filename = options.batch_files.front();
+  options.batch_files.clear();
+  return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// Buffered writer for the values a script prints. Output is collected in a
+// large block and written with one system call when the block fills, at
+// exit, or after every line when stdout is a terminal. The block is only
+// allocated once something is written, so threads that never print pay nothing.
+// Numbers are formatted exactly as `std::cout << double` would.
+class OutputBuffer {
+private:
+  static constexpr std::size_t CAPACITY = 1 << 16;
+
+  std::unique_ptr<char[]> buffer{};
+  std::size_t used = 0;
+  bool line_buffered = false;
+  bool discard = false;
+  std::string *capture = nullptr;
+
+  void WriteOut(const char *data, std::size_t size) {
+    if (capture != nullptr) {
+      capture->append(data, size);
+      return;
+    }
+    // Anything already sent through std::cout/stdio must come out first.
+    std::cout.flush();
+    std::fflush(stdout);
+#if defined(__unix__) || defined(__APPLE__)
+    while (size > 0) {
+      ssize_t written = write(STDOUT_FILENO, data, size);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return; // Nowhere left to report it (e.g. a closed pipe)
+      }
+      data += written;
+      size -= static_cast<std::size_t>(written);
+    }
+#else
+    std::fwrite(data, 1, size, stdout);
+    std::fflush(stdout);
+#endif
+  }
+
+  char *Reserve(std::size_t size) {
+    if (!buffer) {
+      buffer = std::make_unique_for_overwrite<char[]>(CAPACITY);
+    } else if (used + size > CAPACITY) {
+      Flush();
+    }
+    return buffer.get() + used;
+  }
+
+public:
+  OutputBuffer() {
+#if defined(__unix__) || defined(__APPLE__)
+    line_buffered = isatty(STDOUT_FILENO);
+#endif
+  }
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+  ~OutputBuffer() { Flush(); }
+
+  void SetLineBuffered(bool value) { line_buffered = value; }
+  /// Drop output instead of writing it (used while benchmarking).
+  void SetDiscard(bool value) { discard = value; }
+  /// Append output to `sink` instead of stdout (nullptr restores stdout).
+  void SetCapture(std::string *sink) {
+    Flush();
+    capture = sink;
+  }
+
+  void Write(std::string_view text) {
+    if (text.size() > CAPACITY) {
+      Flush();
+      if (!discard) {
+        WriteOut(text.data(), text.size());
+      }
+      return;
+    }
+    std::memcpy(Reserve(text.size()), text.data(), text.size());
+    used += text.size();
+  }
+
+  /// Longest text Format produces.
+  static constexpr std::size_t NUMBER_SIZE = 32;
+
+  /// Write `value` at `out` (NUMBER_SIZE bytes of room) as `std::ostream << double`
+  /// (printf "%g") would; returns the end of the text.
+  static char *Format(char *out, double value) {
+    // %g prints integers below 10^6 in plain decimal, so skip the general formatter for them.
+    if (value == std::trunc(value) && std::fabs(value) < 1e6) {
+      long long whole = static_cast<long long>(value);
+      if (whole == 0 && std::signbit(value)) {
+        *out++ = '-';
+      }
+      return std::to_chars(out, out + NUMBER_SIZE - 1, whole).ptr;
+    }
+    return std::to_chars(out, out + NUMBER_SIZE, value, std::chars_format::general, 6).ptr;
+  }
+
+  /// Same text as the default `std::ostream << double` (printf "%g").
+  void Write(double value) {
+    used = static_cast<std::size_t>(Format(Reserve(NUMBER_SIZE), value) - buffer.get());
+  }
+
+  void EndLine() {
+    *Reserve(1) = '\n';
+    ++used;
+    if (line_buffered) {
+      Flush();
+    }
+  }
+
+  void Flush() {
+    if (used > 0 && !discard) {
+      WriteOut(buffer.get(), used);
+    }
+    used = 0;
+  }
+};
+
+// Program output shared by both execution engines; one per thread so --batch
+// workers can each capture the script they are running.
+thread_local OutputBuffer output;
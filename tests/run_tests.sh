@@ -1,14 +1,32 @@
 #!/bin/bash
 
+# Any arguments (e.g. --vm) are passed through to every ../Project2 run.
+
 # Initialize a counter for differing files
 pass_count=0
 fail_count=0
-test_count=37
+test_count=38
 
 error_pass_count=0
 error_fail_count=0
 error_test_count=16
 
+mode_pass_count=0
+mode_fail_count=0
+mode_test_count=4
+
+watch_pass_count=0
+watch_fail_count=0
+watch_test_count=1
+
+cache_pass_count=0
+cache_fail_count=0
+cache_test_count=1
+
+serve_pass_count=0
+serve_fail_count=0
+serve_test_count=1
+
 # Make sure we have directory current/ to put results in.
 if [ ! -d "$DIR" ]; then
     echo "Directory current/ does not exist. Creating it..."
@@ -24,7 +42,7 @@ for i in $(seq -w 01 $test_count); do
 
     # Generate the output file for Project2
     if [[ -f "../Project2" && -f "$code_file" ]]; then
-        ../Project2 "$code_file" > "$out_file"
+        ../Project2 "$code_file" "$@" > "$out_file"
     else
         echo "Executable ../Project2 or code file $code_file does not exist."
         continue
@@ -53,7 +71,7 @@ for i in $(seq -w 01 $error_test_count); do
 
     # Generate the output file for Project2
     if [[ -f "../Project2" && -f "$code_file" ]]; then
-        ../Project2 "$code_file" > "$out_file"
+        ../Project2 "$code_file" "$@" > "$out_file"
     else
         echo "Executable ../Project2 or code file $code_file does not exist."
         continue
@@ -69,9 +87,181 @@ for i in $(seq -w 01 $error_test_count); do
     fi
 done
 
+# Loop through the tests of command-line modes. The first line of each script
+# is "// flags: <flags>"; what it prints on stdout, then on stderr, then
+# "exit <status>" must match the expected file.
+for i in $(seq -w 01 $mode_test_count); do
+    # Set the file names
+    code_file="test-mode-${i}.Mc"
+    expected_file="expected/output-mode-${i}.txt"
+    out_file="current/output-mode-${i}.txt"
+
+    # Generate the output file for Project2
+    if [[ -f "../Project2" && -f "$code_file" ]]; then
+        flags=$(head -n 1 "$code_file" | sed -n 's|^// flags: ||p')
+        ../Project2 "$code_file" $flags "$@" > "$out_file" 2> current/stderr.txt
+        status=$?
+        cat current/stderr.txt >> "$out_file"
+        echo "exit $status" >> "$out_file"
+        rm -f current/stderr.txt
+    else
+        echo "Executable ../Project2 or code file $code_file does not exist."
+        continue
+    fi
+
+    # Compare the files
+    if [[ -f "$expected_file" ]] && diff -q "$expected_file" "$out_file" > /dev/null; then
+        echo "Mode test $i ... Passed!"
+        ((mode_pass_count++))
+    else
+        echo "Mode test $i ... Failed.  Files $expected_file and $out_file differ."
+        ((mode_fail_count++))
+    fi
+done
+
+# Loop through the --watch tests. Each script is copied to current/, run with
+# --watch, edited in place with the sed expression on its first line
+# ("// edit: <expression>") once the first run has printed, and stopped after
+# the second run. Its stdout, then its stderr with timings removed, must match
+# the expected file.
+for i in $(seq -w 01 $watch_test_count); do
+    # Set the file names
+    code_file="test-watch-${i}.Mc"
+    expected_file="expected/output-watch-${i}.txt"
+    out_file="current/output-watch-${i}.txt"
+    watch_file="current/watch-${i}.Mc"
+
+    if [[ ! -f "../Project2" || ! -f "$code_file" ]]; then
+        echo "Executable ../Project2 or code file $code_file does not exist."
+        continue
+    fi
+    edit=$(head -n 1 "$code_file" | sed -n 's|^// edit: ||p')
+    cp "$code_file" "$watch_file"
+    ../Project2 "$watch_file" --watch "$@" > "$out_file" 2> current/stderr.txt &
+    watch_pid=$!
+    # Wait (up to 5 s each) for the first run, then for the run after the edit.
+    for try in $(seq 50); do
+        [ "$(grep -c '^Watch:' current/stderr.txt)" -ge 1 ] && break
+        sleep 0.1
+    done
+    sleep 0.1
+    sed -i "$edit" "$watch_file"
+    for try in $(seq 50); do
+        [ "$(grep -c '^Watch:' current/stderr.txt)" -ge 2 ] && break
+        sleep 0.1
+    done
+    sleep 0.1
+    kill "$watch_pid"
+    wait "$watch_pid" 2> /dev/null
+    sed 's/ in [0-9.]* ms$//' current/stderr.txt >> "$out_file"
+    rm -f current/stderr.txt "$watch_file"
+
+    # Compare the files
+    if [[ -f "$expected_file" ]] && diff -q "$expected_file" "$out_file" > /dev/null; then
+        echo "Watch test $i ... Passed!"
+        ((watch_pass_count++))
+    else
+        echo "Watch test $i ... Failed.  Files $expected_file and $out_file differ."
+        ((watch_fail_count++))
+    fi
+done
+
+# Loop through the --cache tests. Each script is copied to current/ and run
+# four times with an empty cache: as is (a miss), again (a hit), after the
+# sed expression on its first line ("// edit: <expression>") has changed it,
+# and after its cache entry has been cut short. What each run prints, and its
+# Cache log lines, must match the expected file.
+for i in $(seq -w 01 $cache_test_count); do
+    # Set the file names
+    code_file="test-cache-${i}.Mc"
+    expected_file="expected/output-cache-${i}.txt"
+    out_file="current/output-cache-${i}.txt"
+    cache_file="current/cache-${i}.Mc"
+    cache_dir="current/cache-${i}"
+
+    if [[ ! -f "../Project2" || ! -f "$code_file" ]]; then
+        echo "Executable ../Project2 or code file $code_file does not exist."
+        continue
+    fi
+    edit=$(head -n 1 "$code_file" | sed -n 's|^// edit: ||p')
+    cp "$code_file" "$cache_file"
+    rm -rf "$cache_dir"
+    : > "$out_file"
+    for run in miss hit edit damaged; do
+        [ "$run" == "edit" ] && sed -i "$edit" "$cache_file"
+        [ "$run" == "damaged" ] && truncate -s -4 "$cache_dir"/*.mcc
+        ../Project2 "$cache_file" --cache="$cache_dir" -v "$@" >> "$out_file" 2> current/stderr.txt
+        grep '^Cache' current/stderr.txt >> "$out_file"
+    done
+    rm -rf current/stderr.txt "$cache_file" "$cache_dir"
+
+    # Compare the files
+    if [[ -f "$expected_file" ]] && diff -q "$expected_file" "$out_file" > /dev/null; then
+        echo "Cache test $i ... Passed!"
+        ((cache_pass_count++))
+    else
+        echo "Cache test $i ... Failed.  Files $expected_file and $out_file differ."
+        ((cache_fail_count++))
+    fi
+done
+
+# Loop through the --serve tests. A server is started on a socket in current/
+# and sent, over one connection, the script itself followed by the scripts
+# named on its first line ("// then: <files>"). Every response
+# ("<status> <stdout bytes> <stderr bytes>" and the bytes) must match the
+# expected file.
+for i in $(seq -w 01 $serve_test_count); do
+    # Set the file names
+    code_file="test-serve-${i}.Mc"
+    expected_file="expected/output-serve-${i}.txt"
+    out_file="current/output-serve-${i}.txt"
+    socket="current/serve-${i}.sock"
+
+    if [[ ! -f "../Project2" || ! -f "$code_file" ]]; then
+        echo "Executable ../Project2 or code file $code_file does not exist."
+        continue
+    fi
+    requests=$(head -n 1 "$code_file" | sed -n 's|^// then: ||p')
+    rm -f "$socket"
+    ../Project2 --serve "$socket" -j2 "$@" 2> /dev/null &
+    serve_pid=$!
+    for try in $(seq 50); do
+        [ -S "$socket" ] && break
+        sleep 0.1
+    done
+    perl -MIO::Socket::UNIX -e '
+        my $server = IO::Socket::UNIX->new(Peer => shift) or die "Unable to connect: $!\n";
+        $server->autoflush(1);
+        for my $file (@ARGV) {
+            open(my $in, "<:raw", $file) or die "Unable to read $file\n";
+            my $text = do { local $/; <$in> };
+            print $server length($text), "\n", $text;
+            my $header = <$server>;
+            print $header;
+            my ($status, $out, $err) = split(" ", $header);
+            read($server, my $body, $out + $err);
+            print $body;
+        }' "$socket" "$code_file" $requests > "$out_file" 2>&1
+    kill "$serve_pid"
+    wait "$serve_pid" 2> /dev/null
+
+    # Compare the files
+    if [[ -f "$expected_file" ]] && diff -q "$expected_file" "$out_file" > /dev/null; then
+        echo "Serve test $i ... Passed!"
+        ((serve_pass_count++))
+    else
+        echo "Serve test $i ... Failed.  Files $expected_file and $out_file differ."
+        ((serve_fail_count++))
+    fi
+done
+
 # Report the final count of differing files
 echo "Passed $pass_count of $test_count regular tests (Failed $fail_count)"
 echo "Passed $error_pass_count of $error_test_count error tests (Failed $error_fail_count)"
+echo "Passed $mode_pass_count of $mode_test_count mode tests (Failed $mode_fail_count)"
+echo "Passed $watch_pass_count of $watch_test_count watch tests (Failed $watch_fail_count)"
+echo "Passed $cache_pass_count of $cache_test_count cache tests (Failed $cache_fail_count)"
+echo "Passed $serve_pass_count of $serve_test_count serve tests (Failed $serve_fail_count)"
 
-total_fail_count=$((fail_count + error_fail_count))
+total_fail_count=$((fail_count + error_fail_count + mode_fail_count + watch_fail_count + cache_fail_count + serve_fail_count))
 exit $total_fail_count